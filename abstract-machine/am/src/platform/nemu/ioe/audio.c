@@ -7,20 +7,46 @@
 #define AUDIO_SBUF_SIZE_ADDR (AUDIO_ADDR + 0x0c)
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
+#define AUDIO_COMMIT_ADDR    (AUDIO_ADDR + 0x18)
+
+static uint32_t sbuf_size = 0;
+static uint32_t sbuf_pos = 0; // where the next samples are written in sbuf
 
 void __am_audio_init() {
+  sbuf_size = inl(AUDIO_SBUF_SIZE_ADDR);
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = true;
+  cfg->bufsize = sbuf_size;
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
 }
 
+// Append the samples to the ring in sbuf, waiting for free space.
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  uint8_t *src = ctl->buf.start;
+  uint32_t len = (uint8_t *)ctl->buf.end - src;
+  while (len > 0) {
+    uint32_t space = sbuf_size - inl(AUDIO_COUNT_ADDR);
+    if (space == 0) continue;
+    uint32_t n = (len < space ? len : space);
+    uint32_t i;
+    for (i = 0; i < n; i ++) {
+      outb(AUDIO_SBUF_ADDR + (sbuf_pos + i) % sbuf_size, src[i]);
+    }
+    outl(AUDIO_COMMIT_ADDR, n);
+    sbuf_pos = (sbuf_pos + n) % sbuf_size;
+    src += n;
+    len -= n;
+  }
 }
@@ -31,7 +31,8 @@
 #include <stdlib.h>
 #endif
 
-#if CONFIG_MBASE + CONFIG_MSIZE > 0x100000000ul
+#if CONFIG_MBASE + CONFIG_MSIZE > 0x100000000ul || \
+    (defined(CONFIG_MEM_HIGH) && CONFIG_MEM_HIGH_BASE + CONFIG_MEM_HIGH_SIZE > 0x100000000ul)
 #define PMEM64 1
 #endif
 
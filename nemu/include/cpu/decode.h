@@ -17,15 +17,65 @@
 #define __CPU_DECODE_H__
 
 #include <isa.h>
+#include <cpu/invalidate.h>
 
 typedef struct Decode {
   vaddr_t pc;
   vaddr_t snpc; // static next pc
   vaddr_t dnpc; // dynamic next pc
   ISADecodeInfo isa;
-  IFDEF(CONFIG_ITRACE, char logbuf[128]);
+  IFDEF(CONFIG_DECODE_CACHE, struct DecodeCache *dc);
+  IFDEF(CONFIG_ENGINE_TCACHE, struct DecodeCache *dc_end); // the end of the block being run
 } Decode;
 
+// --- decoded instruction cache ---
+#ifdef CONFIG_DECODE_CACHE
+#define DCACHE_NR_ENTRY (1 << 16)
+
+typedef struct DecodeCache {
+  vaddr_t pc;
+  vaddr_t snpc;
+  ISADecodeInfo isa;
+  const void *handler; // the label in front of the execute body of the matched pattern
+  int type;
+  int rd, rs1, rs2;
+  word_t imm;
+} DecodeCache;
+
+extern DecodeCache dcache[DCACHE_NR_ENTRY];
+
+static inline DecodeCache* dcache_entry(vaddr_t pc) {
+  return &dcache[(pc / DCACHE_INST_ALIGN) & (DCACHE_NR_ENTRY - 1)];
+}
+
+// Return the entry for `pc`. On a miss the entry is claimed for `pc`
+// and will be filled by the pattern matching process.
+static inline DecodeCache* dcache_lookup(vaddr_t pc) {
+  DecodeCache *dc = dcache_entry(pc);
+  if (dc->pc != pc) {
+    dc->pc = pc;
+    dc->handler = NULL;
+  }
+  return dc;
+}
+
+static inline void dcache_save_operand(Decode *s, int type, int rd, int rs1, int rs2, word_t imm) {
+  DecodeCache *dc = s->dc;
+  dc->type = type;
+  dc->rd = rd;
+  dc->rs1 = rs1;
+  dc->rs2 = rs2;
+  dc->imm = imm;
+}
+
+void dcache_flush();
+
+#define dcache_hit(s) ((s)->dc->handler != NULL)
+#else
+#define dcache_save_operand(s, type, rd, rs1, rs2, imm)
+#define dcache_hit(s) false
+#endif
+
 // --- pattern matching mechanism ---
 __attribute__((always_inline))
 static inline void pattern_decode(const char *str, int len,
@@ -87,16 +137,108 @@ finish:
 
 
 // --- pattern matching wrappers for decode ---
+#ifdef CONFIG_DECODE_CACHE
+// The execute body of each pattern is labeled with the line number of
+// the INSTPAT. The address of the label is recorded in the decode cache
+// entry, so that a cache hit can jump to the execute body directly.
+#define INSTPAT_BODY concat(__instpat_body_, __LINE__)
+#define INSTPAT_CACHE(s) \
+  (s)->dc->isa = (s)->isa; \
+  (s)->dc->snpc = (s)->snpc; \
+  (s)->dc->handler = &&INSTPAT_BODY; \
+  INSTPAT_BODY:
+#else
+#define INSTPAT_CACHE(s)
+#endif
+
+#ifdef CONFIG_ENGINE_TCACHE
+// The decoded instructions of a block are run back to back: after the
+// execute body of one instruction, jump to the execute body of the next
+// one, until the end of the block, or until the CPU stops or translated
+// code is written. See isa_exec_block().
+#define INSTPAT_BLOCK_LABEL __instpat_block_next
+#define INSTPAT_BLOCK_NEXT(s) \
+  if (++ (s)->dc < (s)->dc_end && likely(nemu_state.state == NEMU_RUNNING) && !tcache_stale) { \
+    (s)->pc = (s)->dc->pc; \
+    (s)->snpc = (s)->dc->snpc; \
+    (s)->dnpc = (s)->snpc; \
+    goto INSTPAT_BLOCK_LABEL; \
+  }
+#else
+#define INSTPAT_BLOCK_NEXT(s)
+#endif
+
+#ifdef CONFIG_DECODE_TREE
+// Instead of trying the patterns one by one, the decoder indexes a tree
+// (actually a table with one level) with some opcode bits selected by the
+// ISA, and only tries the patterns which can match an instruction with
+// such opcode bits. The table is built from the same INSTPAT list when
+// the decoder runs for the first time: the patterns are only collected
+// instead of being matched, so the matching order is kept.
+typedef struct {
+  uint64_t key, mask, shift;
+  const void *match; // the label in front of INSTPAT_MATCH
+} DecodePattern;
+
+typedef struct {
+  bool ready;
+  int nr_pat, max_pat;
+  DecodePattern *pat;
+  uint32_t *start; // candidates of bucket i are list[start[i], start[i + 1])
+  uint16_t *list;
+} DecodeTree;
+
+void dtree_add(DecodeTree *t, uint64_t key, uint64_t mask, uint64_t shift, const void *match);
+void dtree_build(DecodeTree *t, uint32_t index_mask, int (*index)(uint32_t inst));
+
+#define INSTPAT_MATCH_LABEL concat(__instpat_match_, __LINE__)
+#define INSTPAT_COLLECT(key, mask, shift) \
+  if (__instpat_collect) { \
+    dtree_add(&__instpat_tree, key, mask, shift, &&INSTPAT_MATCH_LABEL); \
+    break; \
+  }
+
+#define INSTPAT_DISPATCH(name) \
+  static DecodeTree __instpat_tree = {}; \
+  bool __instpat_collect = !__instpat_tree.ready; \
+  if (!__instpat_collect) { \
+    concat(__instpat_dispatch_, name): ; \
+    uint32_t __inst = INSTPAT_INST(s); \
+    int __idx = INSTPAT_TREE_INDEX(__inst); \
+    const uint16_t *__p = __instpat_tree.list + __instpat_tree.start[__idx]; \
+    const uint16_t *__end = __instpat_tree.list + __instpat_tree.start[__idx + 1]; \
+    for (; __p < __end; __p ++) { \
+      DecodePattern *__pat = &__instpat_tree.pat[*__p]; \
+      if (((__inst >> __pat->shift) & __pat->mask) == __pat->key) goto *(__pat->match); \
+    } \
+    goto *(__instpat_end); \
+  }
+
+#define INSTPAT_BUILD(name) \
+  if (__instpat_collect) { \
+    dtree_build(&__instpat_tree, INSTPAT_TREE_MASK, INSTPAT_TREE_INDEX); \
+    __instpat_collect = false; \
+    goto concat(__instpat_dispatch_, name); \
+  }
+#else
+#define INSTPAT_COLLECT(key, mask, shift)
+#define INSTPAT_DISPATCH(name)
+#define INSTPAT_BUILD(name)
+#endif
+
 #define INSTPAT(pattern, ...) do { \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
+  INSTPAT_COLLECT(key, mask, shift); \
   if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+    IFDEF(CONFIG_DECODE_TREE, INSTPAT_MATCH_LABEL:) \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
     goto *(__instpat_end); \
   } \
 } while (0)
 
-#define INSTPAT_START(name) { const void ** __instpat_end = &&concat(__instpat_end_, name);
-#define INSTPAT_END(name)   concat(__instpat_end_, name): ; }
+#define INSTPAT_START(name) { const void ** __instpat_end = &&concat(__instpat_end_, name); \
+  INSTPAT_DISPATCH(name)
+#define INSTPAT_END(name)   INSTPAT_BUILD(name) concat(__instpat_end_, name): ; }
 
 #endif
@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #ifndef __CPU_IFETCH_H__
+#define __CPU_IFETCH_H__
 
 #include <memory/vaddr.h>
 
@@ -0,0 +1,79 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_INVALIDATE_H__
+#define __CPU_INVALIDATE_H__
+
+#include <common.h>
+
+/* The hooks called on every write to pmem to keep the caches of decoded
+ * or translated code coherent. This header is included by memory/paddr.h,
+ * so it only depends on common.h.
+ */
+
+#ifdef CONFIG_DECODE_CACHE
+#define DCACHE_INST_ALIGN 4
+#endif
+
+// The tcache engine keeps decoded instructions in its blocks, so only
+// the interpreter uses the global decode cache.
+#if defined(CONFIG_DECODE_CACHE) && !defined(CONFIG_ENGINE_TCACHE)
+#define DCACHE_GLOBAL
+
+// Since paging is not supported yet, the guest pc of an instruction is
+// the same as its physical address. Drop the entries overlapped with
+// the written bytes to deal with self-modifying code.
+void dcache_invalidate(paddr_t addr, int len);
+#endif
+
+#ifdef CONFIG_ENGINE_TCACHE
+extern bool tcache_stale;
+// one bit for each instruction slot in pmem which is held by a block
+extern uint8_t tcache_code_map[CONFIG_MSIZE / DCACHE_INST_ALIGN / 8];
+
+static inline bool tcache_is_code(paddr_t addr) {
+  paddr_t idx = (addr - CONFIG_MBASE) / DCACHE_INST_ALIGN;
+  return (tcache_code_map[idx / 8] >> (idx % 8)) & 1;
+}
+
+// Since blocks may be chained with each other, the whole cache is dropped
+// by the main loop at the next block boundary if translated code is written.
+static inline void tcache_invalidate(paddr_t addr, int len) {
+  if (tcache_is_code(addr) || tcache_is_code(addr + len - 1)) {
+    tcache_stale = true;
+  }
+}
+#endif
+
+#ifdef CONFIG_ENGINE_JIT
+extern bool jit_stale;
+// one bit for each instruction slot in pmem which is translated
+extern uint8_t jit_code_map[CONFIG_MSIZE / 4 / 8];
+
+static inline bool jit_is_code(paddr_t addr) {
+  paddr_t idx = (addr - CONFIG_MBASE) / 4;
+  return (jit_code_map[idx / 8] >> (idx % 8)) & 1;
+}
+
+// The translated code is dropped by the main loop before the next block
+// is executed.
+static inline void jit_invalidate(paddr_t addr, int len) {
+  if (jit_is_code(addr) || jit_is_code(addr + len - 1)) {
+    jit_stale = true;
+  }
+}
+#endif
+
+#endif
@@ -13,12 +13,14 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#ifndef __DEVICE_ALARM_H__
-#define __DEVICE_ALARM_H__
+#ifndef __CPU_JIT_H__
+#define __CPU_JIT_H__
 
-#define TIMER_HZ 60
+#include <common.h>
+#include <cpu/invalidate.h>
 
-typedef void (*alarm_handler_t) ();
-void add_alarm_handle(alarm_handler_t h);
+#ifdef CONFIG_ENGINE_JIT
+uint64_t jit_exec(vaddr_t pc, uint64_t n);
+#endif
 
 #endif
@@ -0,0 +1,53 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_TCACHE_H__
+#define __CPU_TCACHE_H__
+
+#include <cpu/decode.h>
+
+#ifdef CONFIG_ENGINE_TCACHE
+#define TCACHE_NR_BLOCK    (1 << 14)
+#define TCACHE_NR_INST     (1 << 18)
+#define TCACHE_BLOCK_LEN   64 // max number of instructions in a block
+
+// A block holds the decoded instructions starting from `pc` in order.
+// It is recorded during its first execution, and ends at the first
+// instruction which may change the control flow. After that, the block
+// is run by isa_exec_block() without fetching or matching instructions.
+typedef struct TBlock {
+  vaddr_t pc;
+  int nr_inst;
+  bool sealed; // no more instructions will be appended
+  DecodeCache *inst;
+  struct TBlock *hash_next;
+  // successors seen at the exit of the block
+  vaddr_t succ_pc[2];
+  struct TBlock *succ[2];
+} TBlock;
+
+// the successor of `tb` at `pc` if the exit is chained, otherwise NULL
+static inline TBlock* tcache_chained(TBlock *tb, vaddr_t pc) {
+  if (tb->succ[0] != NULL && tb->succ_pc[0] == pc) return tb->succ[0];
+  if (tb->succ[1] != NULL && tb->succ_pc[1] == pc) return tb->succ[1];
+  return NULL;
+}
+
+TBlock* tcache_next(TBlock *prev, vaddr_t pc);
+DecodeCache* tcache_record(TBlock *tb, vaddr_t pc);
+void tcache_flush();
+#endif
+
+#endif
@@ -0,0 +1,43 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+// Device events are timed by the number of guest instructions executed,
+// so that devices behave the same in every run of the same program.
+#define EVENT_INST_PER_SEC CONFIG_EVENT_INST_PER_SEC
+#define EVENT_HZ(hz) (EVENT_INST_PER_SEC / (hz))
+
+#define TIMER_HZ 60
+
+typedef void (*event_handler_t) ();
+
+extern uint64_t g_nr_guest_inst;
+extern uint64_t g_event_deadline;
+
+// Call `handler` after `delay` guest instructions. If `period` is not
+// zero, the handler is called again every `period` instructions.
+void init_event();
+void add_event(uint64_t delay, uint64_t period, event_handler_t handler);
+void event_dispatch();
+
+static inline void event_poll() {
+  if (g_nr_guest_inst >= g_event_deadline) event_dispatch();
+}
+
+#endif
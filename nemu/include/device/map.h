@@ -28,27 +28,58 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  // plain memory without side effects, accessed without a callback;
+  // on writes to byte i, `dirty[i >> dirty_shift]' is set, and it is
+  // cleared by the device
+  bool ram;
+  bool *dirty;
+  int dirty_shift;
 } IOMap;
 
+// a single dirty flag for the whole map
+#define DIRTY_WHOLE 31
+
 static inline bool map_inside(IOMap *map, paddr_t addr) {
   return (addr >= map->low && addr <= map->high);
 }
 
-static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
-  int i;
-  for (i = 0; i < size; i ++) {
-    if (map_inside(maps + i, addr)) {
-      difftest_skip_ref();
-      return i;
-    }
-  }
-  return -1;
+/* The map of an address is found with a two-level table indexed by the
+ * page number. A page covered by a single map as a whole points to the
+ * map directly. Other pages (with the boundaries of maps) point to a
+ * table indexed by the offset inside the page.
+ */
+#define IOMAP_PAGE_SHIFT 12
+#define IOMAP_PAGE_SIZE (1u << IOMAP_PAGE_SHIFT)
+#define IOMAP_L2_BITS 10
+#define IOMAP_L1_BITS (32 - IOMAP_PAGE_SHIFT - IOMAP_L2_BITS)
+
+typedef struct {
+  IOMap *map;
+  IOMap **sub; // maps of each byte, NULL if the page is covered by `map'
+} IOMapPage;
+
+typedef struct {
+  IOMapPage *dir[1 << IOMAP_L1_BITS];
+} IOMapTable;
+
+void iomap_add(IOMapTable *t, IOMap *map);
+
+static inline IOMap* iomap_lookup(IOMapTable *t, paddr_t addr) {
+  if (MUXDEF(PMEM64, addr >> 32, 0)) return NULL;
+  IOMapPage *l2 = t->dir[(uint32_t)addr >> (IOMAP_PAGE_SHIFT + IOMAP_L2_BITS)];
+  if (l2 == NULL) return NULL;
+  IOMapPage *pg = &l2[(addr >> IOMAP_PAGE_SHIFT) & ((1 << IOMAP_L2_BITS) - 1)];
+  IOMap *map = (pg->sub == NULL ? pg->map : pg->sub[addr & (IOMAP_PAGE_SIZE - 1)]);
+  if (map != NULL) { difftest_skip_ref(); }
+  return map;
 }
 
 void add_pio_map(const char *name, ioaddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 void add_mmio_map(const char *name, paddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
+void add_mmio_ram_map(const char *name, paddr_t addr,
+        void *space, uint32_t len, bool *dirty, int dirty_shift);
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
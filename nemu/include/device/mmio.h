@@ -20,5 +20,41 @@
 
 word_t mmio_read(paddr_t addr, int len);
 void mmio_write(paddr_t addr, int len, word_t data);
+uint8_t* mmio_ram_page(paddr_t addr);
+
+/* The page of a plain memory MMIO region (e.g. the frame buffer) accessed
+ * last. The following accesses to the page from paddr_*() go through its
+ * host address without looking up the map. `tag' is invalidated by setting
+ * its page offset bits, like IFetchCache. It is not used with difftest,
+ * since each device access should skip REF.
+ */
+#if defined(CONFIG_DEVICE) && !defined(CONFIG_DIFFTEST)
+#define MMIO_RAM_PAGE_MASK 0xfffu
+
+typedef struct {
+  paddr_t tag;
+  uint8_t *host;
+  bool *dirty;     // dirty flags of the map
+  uint32_t offset; // offset of the page in the map
+  int dirty_shift;
+} MMIORamCache;
+
+extern MMIORamCache mmio_ram_cache;
+
+// A misaligned access never hits, since it may cross the page.
+static inline uint8_t* mmio_ram_host(paddr_t addr, int len) {
+  if ((addr & (~(paddr_t)MMIO_RAM_PAGE_MASK | (len - 1))) != mmio_ram_cache.tag) return NULL;
+  return mmio_ram_cache.host + (addr & MMIO_RAM_PAGE_MASK);
+}
+
+static inline void mmio_ram_set_dirty(paddr_t addr, int len) {
+  uint32_t off = mmio_ram_cache.offset + (addr & MMIO_RAM_PAGE_MASK);
+  mmio_ram_cache.dirty[off >> mmio_ram_cache.dirty_shift] = true;
+  mmio_ram_cache.dirty[(off + len - 1) >> mmio_ram_cache.dirty_shift] = true;
+}
+#else
+static inline uint8_t* mmio_ram_host(paddr_t addr, int len) { return NULL; }
+static inline void mmio_ram_set_dirty(paddr_t addr, int len) {}
+#endif
 
 #endif
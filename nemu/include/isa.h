@@ -36,6 +36,14 @@ word_t isa_reg_str2val(const char *name, bool *success);
 // exec
 struct Decode;
 int isa_exec_once(struct Decode *s);
+#ifdef CONFIG_ENGINE_TCACHE
+struct DecodeCache;
+// Run `n' decoded instructions starting from `dc' without returning
+// between them. Return the number of instructions executed.
+int isa_exec_block(struct Decode *s, struct DecodeCache *dc, int n);
+// whether the instruction may change the control flow, which ends a block
+bool isa_inst_ends_block(struct Decode *s);
+#endif
 
 // memory
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
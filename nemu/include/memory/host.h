@@ -38,4 +38,19 @@ static inline void host_write(void *addr, int len, word_t data) {
   }
 }
 
+#define HOST_ACCESS(bits) \
+  static inline uint##bits##_t host_read##bits(void *addr) { \
+    return *(uint##bits##_t *)addr; \
+  } \
+  static inline void host_write##bits(void *addr, uint##bits##_t data) { \
+    *(uint##bits##_t *)addr = data; \
+  }
+
+HOST_ACCESS(8)
+HOST_ACCESS(16)
+HOST_ACCESS(32)
+#ifdef CONFIG_ISA64
+HOST_ACCESS(64)
+#endif
+
 #endif
@@ -17,13 +17,26 @@
 #define __MEMORY_PADDR_H__
 
 #include <common.h>
+#include <memory/host.h>
+#include <cpu/invalidate.h>
+#include <device/mmio.h>
 
 #define PMEM_LEFT  ((paddr_t)CONFIG_MBASE)
 #define PMEM_RIGHT ((paddr_t)CONFIG_MBASE + CONFIG_MSIZE - 1)
 #define RESET_VECTOR (PMEM_LEFT + CONFIG_PC_RESET_OFFSET)
 
+#if defined(CONFIG_PMEM_MALLOC) || defined(CONFIG_PMEM_MMAP)
+extern uint8_t *pmem;
+#else
+extern uint8_t pmem[];
+#endif
+
+#if defined(CONFIG_MEM_ROM) || defined(CONFIG_MEM_HIGH)
+#define MEM_REGION
+#endif
+
 /* convert the guest physical address in the guest program to host virtual address in NEMU */
-uint8_t* guest_to_host(paddr_t paddr);
+static inline uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 /* convert the host virtual address in NEMU to guest physical address in the guest program */
 paddr_t host_to_guest(uint8_t *haddr);
 
@@ -31,7 +44,90 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
-word_t paddr_read(paddr_t addr, int len);
-void paddr_write(paddr_t addr, int len, word_t data);
+/* the host address of `paddr' in pmem or in an additional memory region,
+ * or NULL if it is not memory, or if it is read-only and `write' is set */
+uint8_t* paddr_to_host(paddr_t paddr, bool write);
+
+// Tell the caches of decoded or translated code that memory is written.
+static inline void pmem_invalidate(paddr_t addr, int len) {
+#ifdef DCACHE_GLOBAL
+  dcache_invalidate(addr, len);
+#endif
+#ifdef MEM_REGION
+  // blocks are only translated from pmem
+  if (!in_pmem(addr)) return;
+#endif
+  IFDEF(CONFIG_ENGINE_TCACHE, tcache_invalidate(addr, len));
+  IFDEF(CONFIG_ENGINE_JIT, jit_invalidate(addr, len));
+}
+
+// accesses outside pmem: other memory areas, MMIO, or out of bound
+word_t paddr_read_slow(paddr_t addr, int len);
+void paddr_write_slow(paddr_t addr, int len, word_t data);
+
+// Only the checks of pmem and the cached MMIO page are inlined, so the
+// switch on `len' in host_*() is resolved at compile time when `len' is
+// a constant.
+static inline word_t paddr_read(paddr_t addr, int len) {
+  if (likely(in_pmem(addr))) return host_read(guest_to_host(addr), len);
+  uint8_t *host = mmio_ram_host(addr, len);
+  if (host != NULL) return host_read(host, len);
+  return paddr_read_slow(addr, len);
+}
+
+static inline void paddr_write(paddr_t addr, int len, word_t data) {
+  if (likely(in_pmem(addr))) {
+    host_write(guest_to_host(addr), len, data);
+    pmem_invalidate(addr, len);
+    return;
+  }
+  uint8_t *host = mmio_ram_host(addr, len);
+  if (host != NULL) {
+    host_write(host, len, data);
+    mmio_ram_set_dirty(addr, len);
+    return;
+  }
+  paddr_write_slow(addr, len, data);
+}
+
+#define PADDR_ACCESS(bits) \
+  static inline uint##bits##_t paddr_read##bits(paddr_t addr) { \
+    if (likely(in_pmem(addr))) return host_read##bits(guest_to_host(addr)); \
+    uint8_t *host = mmio_ram_host(addr, bits / 8); \
+    if (host != NULL) return host_read##bits(host); \
+    return paddr_read_slow(addr, bits / 8); \
+  } \
+  static inline void paddr_write##bits(paddr_t addr, uint##bits##_t data) { \
+    if (likely(in_pmem(addr))) { \
+      host_write##bits(guest_to_host(addr), data); \
+      pmem_invalidate(addr, bits / 8); \
+      return; \
+    } \
+    uint8_t *host = mmio_ram_host(addr, bits / 8); \
+    if (host != NULL) { \
+      host_write##bits(host, data); \
+      mmio_ram_set_dirty(addr, bits / 8); \
+      return; \
+    } \
+    paddr_write_slow(addr, bits / 8, data); \
+  }
+
+PADDR_ACCESS(8)
+PADDR_ACCESS(16)
+PADDR_ACCESS(32)
+#ifdef CONFIG_ISA64
+PADDR_ACCESS(64)
+#endif
+
+void pmem_map_img(paddr_t addr, int fd, size_t size);
+
+void pmem_snapshot_save();
+void pmem_snapshot_restore();
+
+#if (defined(CONFIG_PMEM_MMAP) && defined(CONFIG_MEM_RANDOM)) || defined(CONFIG_SNAPSHOT)
+void pmem_fault_in(paddr_t addr, size_t len);
+#else
+static inline void pmem_fault_in(paddr_t addr, size_t len) {}
+#endif
 
 #endif
@@ -16,14 +16,71 @@
 #ifndef __MEMORY_VADDR_H__
 #define __MEMORY_VADDR_H__
 
-#include <common.h>
-
-word_t vaddr_ifetch(vaddr_t addr, int len);
-word_t vaddr_read(vaddr_t addr, int len);
-void vaddr_write(vaddr_t addr, int len, word_t data);
+#include <isa.h>
+#include <memory/paddr.h>
 
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
 #define PAGE_MASK         (PAGE_SIZE - 1)
 
+void tlb_flush();
+
+// accesses with address translation
+word_t vaddr_read_tlb(vaddr_t addr, int len, int type);
+void vaddr_write_tlb(vaddr_t addr, int len, word_t data);
+
+static inline word_t vaddr_read(vaddr_t addr, int len) {
+  if (isa_mmu_check(addr, len, MEM_TYPE_READ) == MMU_DIRECT) return paddr_read(addr, len);
+  return vaddr_read_tlb(addr, len, MEM_TYPE_READ);
+}
+
+static inline void vaddr_write(vaddr_t addr, int len, word_t data) {
+  if (isa_mmu_check(addr, len, MEM_TYPE_WRITE) == MMU_DIRECT) { paddr_write(addr, len, data); return; }
+  vaddr_write_tlb(addr, len, data);
+}
+
+/* The host address of the page holding the last fetched instruction.
+ * `tag' is the guest virtual address of the page. It is invalidated by
+ * setting its page offset bits, so that it never matches. Writes to
+ * the page need no invalidation, since the instruction is read from
+ * the host page every time.
+ */
+typedef struct {
+  vaddr_t tag;
+  uint8_t *host;
+} IFetchCache;
+
+extern IFetchCache ifetch_cache;
+
+word_t vaddr_ifetch_slow(vaddr_t addr, int len);
+
+static inline word_t vaddr_ifetch(vaddr_t addr, int len) {
+  // The low bits of `addr' are kept for a misaligned fetch, which may
+  // cross the page, so that it goes to the slow path.
+  if (likely((addr & (~PAGE_MASK | (len - 1))) == ifetch_cache.tag)) {
+    return host_read(ifetch_cache.host + (addr & PAGE_MASK), len);
+  }
+  return vaddr_ifetch_slow(addr, len);
+}
+
+// Accessors with the width known at compile time, which are used by the
+// load and store instructions. Only an access to pmem is inlined.
+#define VADDR_ACCESS(bits) \
+  static inline uint##bits##_t vaddr_read##bits(vaddr_t addr) { \
+    if (isa_mmu_check(addr, bits / 8, MEM_TYPE_READ) == MMU_DIRECT) return paddr_read##bits(addr); \
+    return vaddr_read_tlb(addr, bits / 8, MEM_TYPE_READ); \
+  } \
+  static inline void vaddr_write##bits(vaddr_t addr, uint##bits##_t data) { \
+    if (isa_mmu_check(addr, bits / 8, MEM_TYPE_WRITE) == MMU_DIRECT) { paddr_write##bits(addr, data); return; } \
+    vaddr_write_tlb(addr, bits / 8, data); \
+  }
+
+VADDR_ACCESS(8)
+VADDR_ACCESS(16)
+VADDR_ACCESS(32)
+#ifdef CONFIG_ISA64
+VADDR_ACCESS(64)
+#endif
+
+
 #endif
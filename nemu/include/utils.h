@@ -58,11 +58,10 @@ uint64_t get_time();
 
 #define log_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
   do { \
-    extern FILE* log_fp; \
+    extern void log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2))); \
     extern bool log_enable(); \
     if (log_enable()) { \
-      fprintf(log_fp, __VA_ARGS__); \
-      fflush(log_fp); \
+      log_printf(__VA_ARGS__); \
     } \
   } while (0) \
 )
@@ -73,5 +72,22 @@ uint64_t get_time();
     log_write(__VA_ARGS__); \
   } while (0)
 
+// ----------- itrace -----------
+
+void itrace_record(vaddr_t pc, uint32_t inst, int len);
+void itrace_format(char *buf, int size, vaddr_t pc, uint32_t inst, int len);
+void itrace_dump();
+
+// ----------- symbol -----------
+
+const char* symbol_lookup(vaddr_t pc, word_t *offset);
+
+// ----------- snapshot -----------
+
+void snapshot_register(void *ptr, size_t size);
+void snapshot_register_restore(void (*hook)());
+void snapshot_save();
+bool snapshot_restore();
+
 
 #endif
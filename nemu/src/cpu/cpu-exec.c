@@ -16,6 +16,9 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/tcache.h>
+#include <cpu/jit.h>
+#include <device/event.h>
 #include <locale.h>
 #include "../monitor/sdb/sdb.h"
 
@@ -31,13 +34,17 @@ uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
-void device_update();
-
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
-#ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
+#ifdef CONFIG_ITRACE
+  // only format the instruction when it is printed
+  bool log_enable();
+  if (g_print_step || (ITRACE_COND && log_enable())) {
+    char buf[128];
+    itrace_format(buf, sizeof(buf), _this->pc, _this->isa.inst.val, _this->snpc - _this->pc);
+    if (ITRACE_COND) { log_write("%s\n", buf); }
+    if (g_print_step) { puts(buf); }
+  }
 #endif
-  if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
   //每一次运行都查看所有的watchpoint
   step_watchpoint();
@@ -47,44 +54,174 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 static void exec_once(Decode *s, vaddr_t pc) {
   s->pc = pc;
   s->snpc = pc;
+#if defined(CONFIG_DECODE_CACHE) && !defined(CONFIG_ENGINE_TCACHE)
+  s->dc = dcache_lookup(pc);
+#endif
   isa_exec_once(s);
   cpu.pc = s->dnpc;
-#ifdef CONFIG_ITRACE
-  char *p = s->logbuf;
-  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
-  int ilen = s->snpc - s->pc;
-  int i;
-  uint8_t *inst = (uint8_t *)&s->isa.inst.val;
-  for (i = ilen - 1; i >= 0; i --) {
-    p += snprintf(p, 4, " %02x", inst[i]);
+  IFDEF(CONFIG_ITRACE, itrace_record(s->pc, s->isa.inst.val, s->snpc - s->pc));
+}
+
+#ifdef CONFIG_ENGINE_TCACHE
+// The block is recorded while it is executed for the first time.
+static uint64_t tcache_record_block(Decode *s, TBlock *tb, uint64_t n) {
+  DecodeCache uncached;
+  uint64_t i;
+  for (i = 0; i < n; ) {
+    s->dc = tcache_record(tb, cpu.pc);
+    bool cached = (s->dc != NULL);
+    if (!cached) {
+      if (i > 0) break;
+      // the block can not hold any instruction, e.g. outside pmem
+      uncached.handler = NULL;
+      s->dc = &uncached;
+    }
+    s->dc_end = s->dc;
+    exec_once(s, cpu.pc);
+    i ++;
+    g_nr_guest_inst ++;
+    trace_and_difftest(s, cpu.pc);
+    if (nemu_state.state != NEMU_RUNNING || tcache_stale || !cached || isa_inst_ends_block(s)) break;
   }
-  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
-  int space_len = ilen_max - ilen;
-  if (space_len < 0) space_len = 0;
-  space_len = space_len * 3 + 1;
-  memset(p, ' ', space_len);
-  p += space_len;
-
-#ifndef CONFIG_ISA_loongarch32r
-  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
-  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-      MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst.val, ilen);
-#else
-  p[0] = '\0'; // the upstream llvm does not support loongarch32r
+  // blocks are recorded in a row in the pool, so a block
+  // can not grow after another block starts recording
+  tb->sealed = true;
+  return i;
+}
+
+// Run a recorded block one instruction at a time to trace and check them.
+static uint64_t tcache_step_block(Decode *s, TBlock *tb, uint64_t n) {
+  uint64_t i;
+  for (i = 0; i < tb->nr_inst && i < n; ) {
+    isa_exec_block(s, &tb->inst[i], 1);
+    cpu.pc = s->dnpc;
+    IFDEF(CONFIG_ITRACE, itrace_record(s->pc, s->isa.inst.val, s->snpc - s->pc));
+    i ++;
+    g_nr_guest_inst ++;
+    trace_and_difftest(s, cpu.pc);
+    if (nemu_state.state != NEMU_RUNNING || tcache_stale) break;
+  }
+  return i;
+}
+
+#if !defined(CONFIG_ITRACE) && !defined(CONFIG_DIFFTEST)
+/* Run recorded blocks back to back. The exit of a block goes directly to
+ * its chained successor, and only returns to the main loop when the exit
+ * is not chained to a recorded block, when the CPU stops or translated
+ * code is written, or at the deadline of the next device event.
+ */
+static uint64_t tcache_run_blocks(Decode *s, TBlock **ptb, uint64_t n) {
+  TBlock *tb = *ptb;
+#ifdef CONFIG_DEVICE
+  uint64_t until_event = (g_event_deadline > g_nr_guest_inst ? g_event_deadline - g_nr_guest_inst : 1);
+  if (until_event < n) n = until_event;
 #endif
+  uint64_t i = 0;
+  while (true) {
+    int nr = (tb->nr_inst < n - i ? tb->nr_inst : n - i);
+    int nr_exec = isa_exec_block(s, tb->inst, nr);
+    i += nr_exec;
+    cpu.pc = s->dnpc;
+    if (nr_exec < tb->nr_inst || i == n) break;
+    if (nemu_state.state != NEMU_RUNNING || tcache_stale) break;
+    TBlock *next = tcache_chained(tb, cpu.pc);
+    if (next == NULL || !next->sealed || next->nr_inst == 0) break;
+    tb = next;
+  }
+  g_nr_guest_inst += i;
+  *ptb = tb;
+  return i;
+}
 #endif
+
+static void execute(uint64_t n) {
+  Decode s;
+  TBlock *tb = NULL;
+  // watchpoints are checked after every instruction
+  bool step = MUXDEF(CONFIG_ITRACE, true, MUXDEF(CONFIG_DIFFTEST, true, wp_active()));
+  while (n > 0) {
+    if (tcache_stale) { tcache_flush(); tb = NULL; }
+    tb = tcache_next(tb, cpu.pc);
+    if (!tb->sealed || tb->nr_inst == 0) { n -= tcache_record_block(&s, tb, n); }
+    else if (step) { n -= tcache_step_block(&s, tb, n); }
+#if !defined(CONFIG_ITRACE) && !defined(CONFIG_DIFFTEST)
+    else { n -= tcache_run_blocks(&s, &tb, n); }
+#endif
+    if (nemu_state.state != NEMU_RUNNING) return;
+    IFDEF(CONFIG_DEVICE, event_poll());
+  }
 }
+#elif defined(CONFIG_ENGINE_JIT)
+static void execute(uint64_t n) {
+  Decode s;
+  bool block_start = true;
+  while (n > 0) {
+    if (block_start) {
+      uint64_t nr_inst = jit_exec(cpu.pc, n);
+      if (nr_inst > 0) {
+        n -= nr_inst;
+        g_nr_guest_inst += nr_inst;
+        step_watchpoint();
+        if (nemu_state.state != NEMU_RUNNING) break;
+        IFDEF(CONFIG_DEVICE, event_poll());
+        continue;
+      }
+    }
+    // cold code is interpreted
+    exec_once(&s, cpu.pc);
+    n --;
+    g_nr_guest_inst ++;
+    trace_and_difftest(&s, cpu.pc);
+    if (nemu_state.state != NEMU_RUNNING) break;
+    IFDEF(CONFIG_DEVICE, event_poll());
+    block_start = (cpu.pc != s.snpc);
+  }
+}
+#else
+#if !defined(CONFIG_ITRACE) && !defined(CONFIG_DIFFTEST)
+/* When no instruction needs to be traced or checked, instructions
+ * are executed in batches, and device events are only checked between
+ * two batches. A batch ends at the deadline of the next device event.
+ */
+#define FAST_LOOP_BATCH 4096
+
+static void execute_fast(uint64_t n) {
+  Decode s;
+  while (n > 0) {
+    uint64_t batch = (n < FAST_LOOP_BATCH ? n : FAST_LOOP_BATCH);
+#ifdef CONFIG_DEVICE
+    uint64_t until_event = (g_event_deadline > g_nr_guest_inst ? g_event_deadline - g_nr_guest_inst : 1);
+    if (until_event < batch) batch = until_event;
+#endif
+    uint64_t i;
+    for (i = 0; i < batch; ) {
+      exec_once(&s, cpu.pc);
+      i ++;
+      if (nemu_state.state != NEMU_RUNNING) break;
+    }
+    n -= i;
+    g_nr_guest_inst += i;
+    if (nemu_state.state != NEMU_RUNNING) break;
+    IFDEF(CONFIG_DEVICE, event_poll());
+  }
+}
+#endif
 
 static void execute(uint64_t n) {
+#if !defined(CONFIG_ITRACE) && !defined(CONFIG_DIFFTEST)
+  // watchpoints are checked after every instruction
+  if (!wp_active()) { execute_fast(n); return; }
+#endif
   Decode s;
   for (;n > 0; n --) {
     exec_once(&s, cpu.pc);
     g_nr_guest_inst ++;
     trace_and_difftest(&s, cpu.pc);
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    IFDEF(CONFIG_DEVICE, event_poll());
   }
 }
+#endif
 
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
@@ -93,9 +230,29 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+#if defined(CONFIG_ITRACE) && !defined(CONFIG_ISA_loongarch32r)
+  void disasm_cache_stat(uint64_t *hit, uint64_t *miss);
+  uint64_t hit, miss;
+  disasm_cache_stat(&hit, &miss);
+  Log("disassembly cache hit = " NUMBERIC_FMT ", miss = " NUMBERIC_FMT, hit, miss);
+#endif
+#ifdef CONFIG_ENGINE_JIT
+  void jit_stat(uint64_t *block, uint64_t *inst);
+  uint64_t block, inst;
+  jit_stat(&block, &inst);
+  Log("JIT translated blocks = " NUMBERIC_FMT ", instructions in translated code = " NUMBERIC_FMT, block, inst);
+#endif
+#if defined(CONFIG_HAS_VGA) && defined(CONFIG_VGA_SHOW_SCREEN)
+  void vga_upload_stat(uint64_t *pixel);
+  uint64_t pixel;
+  vga_upload_stat(&pixel);
+  Log("screen pixels uploaded = " NUMBERIC_FMT, pixel);
+  if (g_timer > 0) Log("screen upload rate = " NUMBERIC_FMT " pixel/s", pixel * 1000000 / g_timer);
+#endif
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_ITRACE, itrace_dump());
   isa_reg_display();
   statistic();
 }
@@ -126,6 +283,8 @@ void cpu_exec(uint64_t n) {
            (nemu_state.halt_ret == 0 ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN) :
             ANSI_FMT("HIT BAD TRAP", ANSI_FG_RED))),
           nemu_state.halt_pc);
+      IFDEF(CONFIG_ITRACE, if (nemu_state.state == NEMU_ABORT) itrace_dump());
+      IFNDEF(CONFIG_TARGET_AM, if (nemu_state.state == NEMU_ABORT) { void log_flush(); log_flush(); });
       // fall through
     case NEMU_QUIT: statistic();
   }
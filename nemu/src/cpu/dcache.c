@@ -0,0 +1,35 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+
+#ifdef DCACHE_GLOBAL
+DecodeCache dcache[DCACHE_NR_ENTRY] = {};
+
+void dcache_flush() {
+  int i;
+  for (i = 0; i < DCACHE_NR_ENTRY; i ++) {
+    dcache[i].handler = NULL;
+  }
+}
+
+void dcache_invalidate(paddr_t addr, int len) {
+  paddr_t p;
+  for (p = ROUNDDOWN(addr, DCACHE_INST_ALIGN); p < addr + len; p += DCACHE_INST_ALIGN) {
+    DecodeCache *dc = dcache_entry(p);
+    if (dc->pc == p) { dc->handler = NULL; }
+  }
+}
+#endif
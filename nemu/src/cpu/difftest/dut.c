@@ -59,7 +59,7 @@ void difftest_skip_dut(int nr_ref, int nr_dut) {
   }
 }
 
-void init_difftest(char *ref_so_file, long img_size, int port) {
+void init_difftest(char *ref_so_file, char *img_file, long img_size, int port) {
   assert(ref_so_file != NULL);
 
   void *handle;
@@ -86,7 +86,20 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
       "This will help you a lot for debugging, but also significantly reduce the performance. "
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
 
+  // optional, let REF map the image file by itself instead of copying it
+  void (*ref_difftest_memmap)(paddr_t, const char *, size_t) = dlsym(handle, "difftest_memmap");
+
   ref_difftest_init(port);
+  if (ref_difftest_memmap != NULL && img_file != NULL) {
+    ref_difftest_memmap(RESET_VECTOR, img_file, img_size);
+  } else {
+    ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+  }
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+}
+
+// Copy another loaded image and the registers to REF.
+void difftest_reload(long img_size) {
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
 }
@@ -128,5 +141,5 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
   checkregs(&ref_r, pc);
 }
 #else
-void init_difftest(char *ref_so_file, long img_size, int port) { }
+void init_difftest(char *ref_so_file, char *img_file, long img_size, int port) { }
 #endif
@@ -22,6 +22,16 @@ __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction)
   assert(0);
 }
 
+#ifdef CONFIG_PMEM_MMAP_IMG
+// Map the image file used by DUT instead of copying it from DUT.
+__EXPORT void difftest_memmap(paddr_t addr, const char *file, size_t n) {
+  FILE *fp = fopen(file, "rb");
+  Assert(fp, "Can not open '%s'", file);
+  pmem_map_img(addr, fileno(fp), n);
+  fclose(fp);
+}
+#endif
+
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
   assert(0);
 }
@@ -0,0 +1,80 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+
+#ifdef CONFIG_DECODE_TREE
+#define MAX_PATTERN 65536
+
+void dtree_add(DecodeTree *t, uint64_t key, uint64_t mask, uint64_t shift, const void *match) {
+  Assert(t->nr_pat < MAX_PATTERN, "too many patterns");
+  if (t->nr_pat == t->max_pat) {
+    t->max_pat = (t->max_pat == 0 ? 64 : t->max_pat * 2);
+    t->pat = realloc(t->pat, sizeof(t->pat[0]) * t->max_pat);
+    assert(t->pat);
+  }
+  t->pat[t->nr_pat ++] = (DecodePattern) { .key = key, .mask = mask, .shift = shift, .match = match };
+}
+
+// scatter the low bits of `val` to the bit positions set in `mask`
+static uint32_t deposit(uint32_t val, uint32_t mask) {
+  uint32_t res = 0;
+  for (; mask != 0; mask &= mask - 1) {
+    if (val & 1) res |= mask & -mask;
+    val >>= 1;
+  }
+  return res;
+}
+
+// Every bucket lists the patterns in their original order which do not
+// conflict with the index bits of the bucket. The list stops at the first
+// pattern whose fixed bits are all index bits, since it always matches.
+void dtree_build(DecodeTree *t, uint32_t index_mask, int (*index)(uint32_t inst)) {
+  int nr_bucket = 1 << __builtin_popcount(index_mask);
+  uint32_t *rep = malloc(sizeof(rep[0]) * nr_bucket);
+  t->start = malloc(sizeof(t->start[0]) * (nr_bucket + 1));
+  uint16_t *list = malloc(sizeof(list[0]) * nr_bucket * t->nr_pat);
+  assert(rep && t->start && list);
+
+  int b, i;
+  for (b = 0; b < nr_bucket; b ++) { rep[b] = UINT32_MAX; }
+  for (b = 0; b < nr_bucket; b ++) {
+    uint32_t inst = deposit(b, index_mask);
+    int idx = index(inst);
+    Assert(idx >= 0 && idx < nr_bucket && rep[idx] == UINT32_MAX,
+        "index function does not map the index bits one to one");
+    rep[idx] = inst;
+  }
+
+  int n = 0, max_len = 0;
+  for (b = 0; b < nr_bucket; b ++) {
+    t->start[b] = n;
+    for (i = 0; i < t->nr_pat; i ++) {
+      DecodePattern *p = &t->pat[i];
+      uint64_t key = p->key << p->shift, mask = p->mask << p->shift;
+      if ((rep[b] ^ key) & mask & index_mask) continue;
+      list[n ++] = i;
+      if ((mask & ~(uint64_t)index_mask) == 0) break;
+    }
+    if (n - t->start[b] > max_len) { max_len = n - t->start[b]; }
+  }
+  t->start[nr_bucket] = n;
+  t->list = realloc(list, sizeof(list[0]) * (n + 1));
+  free(rep);
+  t->ready = true;
+  Log("Decode tree: %d patterns, %d buckets, at most %d candidates per bucket",
+      t->nr_pat, nr_bucket, max_len);
+}
+#endif
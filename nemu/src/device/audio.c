@@ -16,23 +16,179 @@
 #include <common.h>
 #include <device/map.h>
 #include <SDL2/SDL.h>
+#include <unistd.h>
 
+/* The registers are 32 bits wide. After the guest appends samples to
+ * sbuf (see below), it writes the number of bytes appended to reg_commit.
+ * reg_count is read-only, and returns the number of bytes in sbuf which
+ * are not consumed yet.
+ */
 enum {
   reg_freq,
   reg_channels,
   reg_samples,
-  reg_sbuf_size,
-  reg_init,
-  reg_count,
+  reg_sbuf_size, // RO
+  reg_init,      // a nonzero write opens the stream with the settings above
+  reg_count,     // RO
+  reg_commit,    // WO
   nr_reg
 };
 
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
+static bool sbuf_dirty = false;
+
+/* sbuf is a ring shared by the guest and the consumer of the samples.
+ * The guest writes the samples after the previous ones (wrapping around
+ * at the end of sbuf), and then commits them with reg_commit. The indices
+ * run freely and are only taken modulo the size of sbuf when indexing.
+ * `sb_r' is only written by the CPU thread and `sb_f' only by the
+ * consumer (the SDL audio callback), so no lock is needed except for
+ * restoring snapshots.
+ */
+static uint32_t sb_r = 0, sb_f = 0;
+
+static uint32_t sbuf_count() {
+  return __atomic_load_n(&sb_r, __ATOMIC_ACQUIRE) - __atomic_load_n(&sb_f, __ATOMIC_ACQUIRE);
+}
+
+// the first part of `len' bytes at index `f' before wrapping around
+static uint32_t sbuf_part(uint32_t f, uint32_t len) {
+  uint32_t off = f % CONFIG_SB_SIZE;
+  return (len < CONFIG_SB_SIZE - off ? len : CONFIG_SB_SIZE - off);
+}
+
+#ifdef CONFIG_AUDIO_WAV
+/* Instead of being played, the samples are appended to a WAV file as soon
+ * as the guest commits them, so the ring is always empty. The sizes in the
+ * header are filled when NEMU exits.
+ */
+static FILE *wav_fp = NULL;
+static bool wav_ready = false;
+static uint32_t wav_size = 0;
+
+static void wav_write32(uint32_t x) { fwrite(&x, 4, 1, wav_fp); }
+static void wav_write16(uint16_t x) { fwrite(&x, 2, 1, wav_fp); }
+
+static void wav_fix_size() {
+  if (!wav_ready) return;
+  fseek(wav_fp, 4, SEEK_SET);
+  wav_write32(36 + wav_size);
+  fseek(wav_fp, 40, SEEK_SET);
+  wav_write32(wav_size);
+  fclose(wav_fp);
+}
+
+static void audio_open() {
+  int freq = audio_base[reg_freq], channels = audio_base[reg_channels];
+  // start a new file on every initialization
+  wav_ready = true;
+  wav_size = 0;
+  rewind(wav_fp);
+  assert(ftruncate(fileno(wav_fp), 0) == 0);
+  fwrite("RIFF", 4, 1, wav_fp);
+  wav_write32(36);
+  fwrite("WAVEfmt ", 8, 1, wav_fp);
+  wav_write32(16);
+  wav_write16(1); // PCM
+  wav_write16(channels);
+  wav_write32(freq);
+  wav_write32(freq * channels * 2); // bytes per second
+  wav_write16(channels * 2);        // bytes per frame
+  wav_write16(16);                  // bits per sample
+  fwrite("data", 4, 1, wav_fp);
+  wav_write32(0);
+}
+
+static void audio_consume() {
+  if (!wav_ready) return;
+  uint32_t n = sbuf_count();
+  uint32_t n1 = sbuf_part(sb_f, n);
+  fwrite(sbuf + sb_f % CONFIG_SB_SIZE, 1, n1, wav_fp);
+  fwrite(sbuf, 1, n - n1, wav_fp);
+  wav_size += n;
+  __atomic_store_n(&sb_f, sb_f + n, __ATOMIC_RELEASE);
+}
+
+static void init_audio_sink() {
+  const char *path = CONFIG_AUDIO_WAV_FILE;
+  wav_fp = fopen(path, "w");
+  Assert(wav_fp, "Can not open '%s'", path);
+  atexit(wav_fix_size);
+  Log("Audio is written to %s", path);
+}
+#else
+// Called by the SDL audio thread. Silence is played on underrun.
+static void audio_callback(void *userdata, uint8_t *stream, int len) {
+  uint32_t n = sbuf_count();
+  if (n > (uint32_t)len) n = len;
+  uint32_t f = __atomic_load_n(&sb_f, __ATOMIC_RELAXED);
+  uint32_t n1 = sbuf_part(f, n);
+  memcpy(stream, sbuf + f % CONFIG_SB_SIZE, n1);
+  memcpy(stream + n1, sbuf, n - n1);
+  memset(stream + n, 0, len - n);
+  __atomic_store_n(&sb_f, f + n, __ATOMIC_RELEASE);
+}
+
+static void audio_open() {
+  SDL_CloseAudio();
+  sb_f = sb_r;
+  SDL_AudioSpec s = {};
+  s.format = AUDIO_S16SYS;
+  s.userdata = NULL;
+  s.freq = audio_base[reg_freq];
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_callback;
+  if (SDL_OpenAudio(&s, NULL) != 0) {
+    Log("Can not open audio: freq = %d, channels = %d, samples = %d", s.freq, s.channels, s.samples);
+    return;
+  }
+  SDL_PauseAudio(0);
+}
+
+#define audio_consume()
+
+static void init_audio_sink() {
+  SDL_InitSubSystem(SDL_INIT_AUDIO);
+}
+#endif
 
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  assert(offset % sizeof(uint32_t) == 0 && len == sizeof(uint32_t));
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && audio_base[reg_init] != 0) { audio_open(); }
+      break;
+    case reg_count:
+      if (!is_write) { audio_base[reg_count] = sbuf_count(); }
+      break;
+    case reg_commit:
+      if (is_write) {
+        uint32_t n = audio_base[reg_commit];
+        uint32_t space = CONFIG_SB_SIZE - sbuf_count();
+        // the guest has already overwritten the samples not consumed
+        if (n > space) n = space;
+        __atomic_store_n(&sb_r, sb_r + n, __ATOMIC_RELEASE);
+        audio_consume();
+      }
+      break;
+  }
 }
 
+#ifdef CONFIG_SNAPSHOT
+/* `sb_r' is saved in snapshots to keep the ring aligned with the position
+ * where the restored guest writes its next samples. The samples queued
+ * before restoring are dropped by moving `sb_f' to `sb_r'.
+ */
+static void audio_restore() {
+  IFNDEF(CONFIG_AUDIO_WAV, SDL_LockAudio());
+  __atomic_store_n(&sb_f, sb_r, __ATOMIC_RELEASE);
+  IFNDEF(CONFIG_AUDIO_WAV, SDL_UnlockAudio());
+  audio_base[reg_count] = 0;
+}
+#endif
+
 void init_audio() {
   uint32_t space_size = sizeof(uint32_t) * nr_reg;
   audio_base = (uint32_t *)new_space(space_size);
@@ -42,6 +198,11 @@ void init_audio() {
   add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_io_handler);
 #endif
 
+  Assert((CONFIG_SB_SIZE & (CONFIG_SB_SIZE - 1)) == 0, "the size of sbuf should be a power of 2");
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
-  add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
+  add_mmio_ram_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, &sbuf_dirty, DIRTY_WHOLE);
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
+  init_audio_sink();
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register(&sb_r, sizeof(sb_r)));
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register_restore(audio_restore));
 }
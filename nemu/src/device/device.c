@@ -15,7 +15,7 @@
 
 #include <common.h>
 #include <utils.h>
-#include <device/alarm.h>
+#include <device/event.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -28,27 +28,26 @@ void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
-void init_alarm();
 
 void send_key(uint8_t, bool);
 void vga_update_screen();
+void vga_init_screen();
+void vga_present_screen();
 
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
+#ifdef CONFIG_SDL_IO_THREAD
+#include <pthread.h>
 
-  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+static bool sdl_quit = false;
+#endif
 
+static void sdl_poll_event() {
 #ifndef CONFIG_TARGET_AM
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
       case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
+        MUXDEF(CONFIG_SDL_IO_THREAD, __atomic_store_n(&sdl_quit, true, __ATOMIC_RELAXED),
+            nemu_state.state = NEMU_QUIT);
         break;
 #ifdef CONFIG_HAS_KEYBOARD
       // If a key was pressed
@@ -66,8 +65,42 @@ void device_update() {
 #endif
 }
 
+#ifdef CONFIG_SDL_IO_THREAD
+/* The window is created, polled and presented by this thread, since SDL
+ * requires them to be done by the same thread. The CPU thread only hands
+ * off frames with vga_update_screen(), and receives keys from the queue
+ * of the keyboard.
+ */
+static void* sdl_io_thread(void *arg) {
+  vga_init_screen();
+  while (true) {
+    sdl_poll_event();
+    vga_present_screen();
+    SDL_Delay(1000 / TIMER_HZ);
+  }
+  return NULL;
+}
+
+static void init_sdl_io_thread() {
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, sdl_io_thread, NULL) == 0);
+  pthread_detach(thread);
+}
+#endif
+
+static void device_update() {
+  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+#ifdef CONFIG_SDL_IO_THREAD
+  if (__atomic_load_n(&sdl_quit, __ATOMIC_RELAXED)) { nemu_state.state = NEMU_QUIT; }
+#else
+  sdl_poll_event();
+#endif
+}
+
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
+  // events are always consumed by the I/O thread, and keys are only
+  // sent when the guest is running
+#if !defined(CONFIG_TARGET_AM) && !defined(CONFIG_SDL_IO_THREAD)
   SDL_Event event;
   while (SDL_PollEvent(&event));
 #endif
@@ -76,6 +109,7 @@ void sdl_clear_event_queue() {
 void init_device() {
   IFDEF(CONFIG_TARGET_AM, ioe_init());
   init_map();
+  init_event();
 
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
@@ -85,5 +119,7 @@ void init_device() {
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
 
-  IFNDEF(CONFIG_TARGET_AM, init_alarm());
+  IFDEF(CONFIG_SDL_IO_THREAD, init_sdl_io_thread());
+
+  add_event(EVENT_HZ(TIMER_HZ), EVENT_HZ(TIMER_HZ), device_update);
 }
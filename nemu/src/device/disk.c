@@ -13,7 +13,96 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#include <isa.h>
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The guest sets the buffer address and the blocks to transfer, then
+ * writes the direction to reg_cmd. The blocks are copied between the
+ * image (mapped into NEMU) and the memory with a single memcpy(), so
+ * the transfer completes before the write to reg_cmd returns. This is
+ * the layout used by the AM driver (am/src/platform/nemu/ioe/disk.c).
+ */
+#define BLKSZ 512
+
+enum {
+  reg_present,
+  reg_blksz,
+  reg_blkcnt,
+  reg_buf,    // physical address of the buffer
+  reg_blkno,
+  reg_nr_blk,
+  reg_cmd,    // 0 to read from the disk, 1 to write to the disk
+  reg_status, // always ready
+  nr_reg
+};
+
+static uint32_t *disk_base = NULL;
+static uint8_t *img = NULL;
+
+static void disk_transfer(bool is_write) {
+  uint32_t blkno = disk_base[reg_blkno], n = disk_base[reg_nr_blk];
+  paddr_t buf = disk_base[reg_buf];
+  if (n == 0) return;
+  Assert(img != NULL, "no disk image at pc = " FMT_WORD, cpu.pc);
+  Assert((uint64_t)blkno + n <= disk_base[reg_blkcnt],
+      "blocks [%u, %u) are out of bound of the disk at pc = " FMT_WORD, blkno, blkno + n, cpu.pc);
+  size_t len = (size_t)n * BLKSZ;
+  // memory is written when reading from the disk
+  uint8_t *host = paddr_to_host(buf, !is_write);
+  Assert(host != NULL && paddr_to_host(buf + len - 1, !is_write) == host + len - 1,
+      "buffer [" FMT_PADDR ", " FMT_PADDR ") is out of bound of memory at pc = " FMT_WORD,
+      buf, (paddr_t)(buf + len), cpu.pc);
+  uint8_t *blk = img + (size_t)blkno * BLKSZ;
+  if (is_write) { memcpy(blk, host, len); }
+  else {
+    memcpy(host, blk, len);
+    pmem_invalidate(buf, len);
+    IFDEF(CONFIG_DIFFTEST, ref_difftest_memcpy(buf, host, len, DIFFTEST_TO_REF));
+  }
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == reg_cmd * sizeof(uint32_t)) {
+    disk_transfer(disk_base[reg_cmd] != 0);
+  }
+}
+
+static void init_img() {
+  const char *path = CONFIG_DISK_IMG_PATH;
+  if (path[0] == '\0') {
+    Log("No disk image is set by CONFIG_DISK_IMG_PATH, the disk is absent");
+    return;
+  }
+  int fd = open(path, O_RDWR);
+  if (fd < 0) { Log("Can not find disk image: %s", path); return; }
+  struct stat st;
+  assert(fstat(fd, &st) == 0);
+  size_t size = ROUNDDOWN(st.st_size, BLKSZ);
+  if (size > 0) {
+    // shared, so that the written blocks go to the image file
+    img = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "fail to mmap disk image %s", path);
+  }
+  close(fd);
+  disk_base[reg_present] = (img != NULL);
+  disk_base[reg_blkcnt] = size / BLKSZ;
+  Log("Disk image %s, %u blocks", path, disk_base[reg_blkcnt]);
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler);
+#endif
+  disk_base[reg_blksz] = BLKSZ;
+  disk_base[reg_status] = 1;
+  init_img();
 }
@@ -0,0 +1,79 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/event.h>
+
+#define MAX_EVENT 16
+
+typedef struct {
+  uint64_t deadline;
+  uint64_t period;
+  event_handler_t handler;
+} Event;
+
+// a min-heap ordered by deadline
+static Event heap[MAX_EVENT] = {};
+static int nr_event = 0;
+uint64_t g_event_deadline = -1;
+
+static void heap_push(Event e) {
+  Assert(nr_event < MAX_EVENT, "too many device events");
+  int i = nr_event ++;
+  while (i > 0 && heap[(i - 1) / 2].deadline > e.deadline) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = e;
+}
+
+static Event heap_pop() {
+  Event top = heap[0];
+  Event last = heap[-- nr_event];
+  int i = 0;
+  while (2 * i + 1 < nr_event) {
+    int child = 2 * i + 1;
+    if (child + 1 < nr_event && heap[child + 1].deadline < heap[child].deadline) child ++;
+    if (last.deadline <= heap[child].deadline) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+  return top;
+}
+
+void init_event() {
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register(heap, sizeof(heap)));
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register(&nr_event, sizeof(nr_event)));
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register(&g_event_deadline, sizeof(g_event_deadline)));
+}
+
+void add_event(uint64_t delay, uint64_t period, event_handler_t handler) {
+  heap_push((Event) { .deadline = g_nr_guest_inst + delay, .period = period, .handler = handler });
+  g_event_deadline = heap[0].deadline;
+}
+
+void event_dispatch() {
+  while (nr_event > 0 && heap[0].deadline <= g_nr_guest_inst) {
+    Event e = heap_pop();
+    if (e.period != 0) {
+      e.deadline += e.period;
+      // do not try to catch up after a long batch of instructions
+      if (e.deadline <= g_nr_guest_inst) e.deadline = g_nr_guest_inst + e.period;
+      heap_push(e);
+    }
+    e.handler();
+  }
+  g_event_deadline = (nr_event > 0 ? heap[0].deadline : -1);
+}
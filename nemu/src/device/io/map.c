@@ -29,16 +29,49 @@ uint8_t* new_space(int size) {
   size = (size + (PAGE_SIZE - 1)) & ~PAGE_MASK;
   p_space += size;
   assert(p_space - io_space < IO_SPACE_MAX);
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register(p, size));
   return p;
 }
 
-static void check_bound(IOMap *map, paddr_t addr) {
-  if (map == NULL) {
-    Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
-  } else {
-    Assert(addr <= map->high && addr >= map->low,
-        "address (" FMT_PADDR ") is out of bound {%s} [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
-        addr, map->name, map->low, map->high, cpu.pc);
+static void check_bound(IOMap *map, paddr_t addr, int len) {
+  // the table of maps only returns a map containing `addr', but the
+  // access may still run past the end of the map
+  Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
+  IFDEF(CONFIG_RT_CHECK, Assert(len >= 1 && len <= 8 && addr + len - 1 <= map->high,
+      "address (" FMT_PADDR ") with len = %d is out of bound {%s} [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
+      addr, len, map->name, map->low, map->high, cpu.pc));
+}
+
+static IOMapPage* iomap_page(IOMapTable *t, paddr_t addr) {
+  IOMapPage **l2 = &t->dir[(uint32_t)addr >> (IOMAP_PAGE_SHIFT + IOMAP_L2_BITS)];
+  if (*l2 == NULL) {
+    *l2 = calloc(1 << IOMAP_L2_BITS, sizeof(IOMapPage));
+    assert(*l2);
+  }
+  return &(*l2)[(addr >> IOMAP_PAGE_SHIFT) & ((1 << IOMAP_L2_BITS) - 1)];
+}
+
+void iomap_add(IOMapTable *t, IOMap *map) {
+  Assert(MUXDEF(PMEM64, map->high >> 32 == 0, true),
+      "map '%s' is out of the 32-bit address space", map->name);
+  uint64_t page = ROUNDDOWN(map->low, IOMAP_PAGE_SIZE);
+  for (; page <= map->high; page += IOMAP_PAGE_SIZE) {
+    IOMapPage *pg = iomap_page(t, page);
+    assert(pg->map == NULL);
+    uint64_t l = (map->low > page ? map->low : page);
+    uint64_t r = (map->high < page + IOMAP_PAGE_SIZE - 1 ? map->high : page + IOMAP_PAGE_SIZE - 1);
+    if (pg->sub == NULL && l == page && r == page + IOMAP_PAGE_SIZE - 1) {
+      pg->map = map;
+      continue;
+    }
+    if (pg->sub == NULL) {
+      pg->sub = calloc(IOMAP_PAGE_SIZE, sizeof(IOMap *));
+      assert(pg->sub);
+    }
+    for (; l <= r; l ++) {
+      assert(pg->sub[l - page] == NULL);
+      pg->sub[l - page] = map;
+    }
   }
 }
 
@@ -53,8 +86,7 @@ void init_map() {
 }
 
 word_t map_read(paddr_t addr, int len, IOMap *map) {
-  assert(len >= 1 && len <= 8);
-  check_bound(map, addr);
+  check_bound(map, addr, len);
   paddr_t offset = addr - map->low;
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
@@ -62,8 +94,7 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
 }
 
 void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
-  assert(len >= 1 && len <= 8);
-  check_bound(map, addr);
+  check_bound(map, addr, len);
   paddr_t offset = addr - map->low;
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
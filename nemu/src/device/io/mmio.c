@@ -14,17 +14,14 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
 
 #define NR_MAP 16
 
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
-
-static IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
-}
+static IOMapTable table = {};
 
 static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
     const char *name2, paddr_t l2, paddr_t r2) {
@@ -32,13 +29,17 @@ static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
                "with %s@[" FMT_PADDR ", " FMT_PADDR "]", name1, l1, r1, name2, l2, r2);
 }
 
-/* device interface */
-void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
+static void add_map(const char *name, paddr_t addr, void *space, uint32_t len,
+    io_callback_t callback, bool *dirty, int dirty_shift) {
   assert(nr_map < NR_MAP);
   paddr_t left = addr, right = addr + len - 1;
   if (in_pmem(left) || in_pmem(right)) {
     report_mmio_overlap(name, left, right, "pmem", PMEM_LEFT, PMEM_RIGHT);
   }
+  if (paddr_to_host(left, false) != NULL || paddr_to_host(right, false) != NULL) {
+    panic("MMIO region %s@[" FMT_PADDR ", " FMT_PADDR "] is overlapped "
+        "with a memory area", name, left, right);
+  }
   for (int i = 0; i < nr_map; i++) {
     if (left <= maps[i].high && right >= maps[i].low) {
       report_mmio_overlap(name, left, right, maps[i].name, maps[i].low, maps[i].high);
@@ -46,18 +47,80 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
   }
 
   maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
-    .space = space, .callback = callback };
+    .space = space, .callback = callback, .ram = (dirty != NULL), .dirty = dirty,
+    .dirty_shift = dirty_shift };
   Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
       maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
 
+  iomap_add(&table, &maps[nr_map]);
   nr_map ++;
 }
 
+/* device interface */
+void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
+  add_map(name, addr, space, len, callback, NULL, 0);
+}
+
+// Map a region of plain memory (e.g. the frame buffer). It is accessed
+// directly through the host pointer without calling back the device.
+// `dirty' should hold a flag for every (1 << dirty_shift) bytes.
+void add_mmio_ram_map(const char *name, paddr_t addr, void *space, uint32_t len,
+    bool *dirty, int dirty_shift) {
+  assert(dirty != NULL);
+  add_map(name, addr, space, len, NULL, dirty, dirty_shift);
+}
+
+// Return the offset of the page containing `addr' in the map if the
+// whole page is plain memory, otherwise -1.
+static int64_t ram_page_offset(IOMap *map, paddr_t addr) {
+  paddr_t page = addr & ~(paddr_t)(IOMAP_PAGE_SIZE - 1);
+  if (map == NULL || !map->ram || page < map->low ||
+      (uint64_t)page + IOMAP_PAGE_SIZE - 1 > map->high) return -1;
+  return page - map->low;
+}
+
+#if defined(CONFIG_DEVICE) && !defined(CONFIG_DIFFTEST)
+static_assert(MMIO_RAM_PAGE_MASK == IOMAP_PAGE_SIZE - 1, "the cached page is not a map page");
+MMIORamCache mmio_ram_cache = { .tag = MMIO_RAM_PAGE_MASK };
+
+static void mmio_ram_cache_fill(IOMap *map, paddr_t addr) {
+  int64_t off = ram_page_offset(map, addr);
+  if (off < 0) return;
+  mmio_ram_cache = (MMIORamCache) { .tag = addr & ~(paddr_t)MMIO_RAM_PAGE_MASK,
+    .host = (uint8_t *)map->space + off, .dirty = map->dirty, .offset = off,
+    .dirty_shift = map->dirty_shift };
+}
+#else
+static void mmio_ram_cache_fill(IOMap *map, paddr_t addr) {}
+#endif
+
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
-  return map_read(addr, len, fetch_mmio_map(addr));
+  IOMap *map = iomap_lookup(&table, addr);
+  if (likely(map != NULL && map->ram)) {
+    mmio_ram_cache_fill(map, addr);
+    return host_read((uint8_t *)map->space + (addr - map->low), len);
+  }
+  return map_read(addr, len, map);
 }
 
 void mmio_write(paddr_t addr, int len, word_t data) {
-  map_write(addr, len, data, fetch_mmio_map(addr));
+  IOMap *map = iomap_lookup(&table, addr);
+  if (likely(map != NULL && map->ram)) {
+    mmio_ram_cache_fill(map, addr);
+    paddr_t off = addr - map->low;
+    host_write((uint8_t *)map->space + off, len, data);
+    map->dirty[off >> map->dirty_shift] = true;
+    map->dirty[(off + len - 1) >> map->dirty_shift] = true;
+    return;
+  }
+  map_write(addr, len, data, map);
+}
+
+// Return the host address of the page containing `addr' if the whole
+// page is plain memory, otherwise NULL.
+uint8_t* mmio_ram_page(paddr_t addr) {
+  IOMap *map = iomap_lookup(&table, addr);
+  int64_t off = ram_page_offset(map, addr);
+  return (off < 0 ? NULL : (uint8_t *)map->space + off);
 }
@@ -20,6 +20,7 @@
 #define NR_MAP 16
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
+static IOMapTable table = {};
 
 /* device interface */
 void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_callback_t callback) {
@@ -30,20 +31,21 @@ void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_
   Log("Add port-io map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
       maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
 
+  iomap_add(&table, &maps[nr_map]);
   nr_map ++;
 }
 
 /* CPU interface */
 uint32_t pio_read(ioaddr_t addr, int len) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  assert(mapid != -1);
-  return map_read(addr, len, &maps[mapid]);
+  IOMap *map = iomap_lookup(&table, addr);
+  assert(map != NULL);
+  return map_read(addr, len, map);
 }
 
 void pio_write(ioaddr_t addr, int len, uint32_t data) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  assert(mapid != -1);
-  map_write(addr, len, data, &maps[mapid]);
+  IOMap *map = iomap_lookup(&table, addr);
+  assert(map != NULL);
+  map_write(addr, len, data, map);
 }
@@ -45,25 +45,39 @@ static void init_keymap() {
   MAP(NEMU_KEYS, SDL_KEYMAP)
 }
 
+// Keys may be sent by the I/O thread and received by the CPU thread.
+// `key_r' is only written by the sender and `key_f' only by the receiver,
+// so the queue works without locks.
 #define KEY_QUEUE_LEN 1024
 static int key_queue[KEY_QUEUE_LEN] = {};
 static int key_f = 0, key_r = 0;
 
 static void key_enqueue(uint32_t am_scancode) {
-  key_queue[key_r] = am_scancode;
-  key_r = (key_r + 1) % KEY_QUEUE_LEN;
-  Assert(key_r != key_f, "key queue overflow!");
+  int r = key_r;
+  key_queue[r] = am_scancode;
+  r = (r + 1) % KEY_QUEUE_LEN;
+  Assert(r != __atomic_load_n(&key_f, __ATOMIC_ACQUIRE), "key queue overflow!");
+  __atomic_store_n(&key_r, r, __ATOMIC_RELEASE);
 }
 
 static uint32_t key_dequeue() {
   uint32_t key = NEMU_KEY_NONE;
-  if (key_f != key_r) {
-    key = key_queue[key_f];
-    key_f = (key_f + 1) % KEY_QUEUE_LEN;
+  int f = key_f;
+  if (f != __atomic_load_n(&key_r, __ATOMIC_ACQUIRE)) {
+    key = key_queue[f];
+    __atomic_store_n(&key_f, (f + 1) % KEY_QUEUE_LEN, __ATOMIC_RELEASE);
   }
   return key;
 }
 
+#ifdef CONFIG_SNAPSHOT
+// Drop the queued keys when a snapshot is restored. This is done by the
+// receiver, since `key_r' is only written by the sender.
+static void key_queue_restore() {
+  __atomic_store_n(&key_f, __atomic_load_n(&key_r, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+#endif
+
 void send_key(uint8_t scancode, bool is_keydown) {
   if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != NEMU_KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
@@ -97,4 +111,5 @@ void init_i8042() {
   add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
 #endif
   IFNDEF(CONFIG_TARGET_AM, init_keymap());
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register_restore(key_queue_restore));
 }
@@ -127,6 +127,11 @@ void init_sdcard() {
   add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register(&blkcnt, sizeof(blkcnt)));
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register(&blk_addr, sizeof(blk_addr)));
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register(&addr, sizeof(addr)));
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register(&write_cmd, sizeof(write_cmd)));
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register(&read_ext_csd, sizeof(read_ext_csd)));
 
   const char *img = CONFIG_SDCARD_IMG_PATH;
   fp = fopen(img, "r+");
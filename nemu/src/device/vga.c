@@ -34,7 +34,58 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+/* Writes to vmem set a dirty flag for every (1 << VMEM_DIRTY_SHIFT) bytes.
+ * On syncing, the flags are collected into dirty scanlines, and only the
+ * bands of contiguous dirty scanlines are uploaded. Nothing is presented
+ * if no scanline is dirty.
+ */
+#define VMEM_DIRTY_SHIFT 8
+static bool *vmem_dirty = NULL;
+static bool redraw = false; // update the screen even if the guest does not sync
+
+static int nr_vmem_dirty() {
+  return (screen_size() + (1 << VMEM_DIRTY_SHIFT) - 1) >> VMEM_DIRTY_SHIFT;
+}
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
+static bool *row_dirty = NULL; // accumulated until uploaded
+static uint64_t nr_upload_pixel = 0; // only updated by the thread presenting the screen
+
+static uint32_t screen_pitch() {
+  return screen_width() * sizeof(uint32_t);
+}
+
+static void collect_dirty_rows() {
+  int n = nr_vmem_dirty(), h = screen_height(), i;
+  for (i = 0; i < n; i ++) {
+    if (!vmem_dirty[i]) continue;
+    vmem_dirty[i] = false;
+    int y0 = ((uint32_t)i << VMEM_DIRTY_SHIFT) / screen_pitch();
+    int y1 = (((uint32_t)(i + 1) << VMEM_DIRTY_SHIFT) - 1) / screen_pitch();
+    if (y1 >= h) y1 = h - 1;
+    memset(row_dirty + y0, true, y1 - y0 + 1);
+  }
+}
+
+// Call `f' on each band of dirty scanlines in `rows', and clear them.
+// Return whether there is any.
+static bool for_each_dirty_band(bool *rows, void (*f)(int y, int h)) {
+  int h = screen_height(), y = 0;
+  bool any = false;
+  while (y < h) {
+    if (!rows[y]) { y ++; continue; }
+    int y0 = y;
+    while (y < h && rows[y]) { rows[y] = false; y ++; }
+    f(y0, y - y0);
+    any = true;
+  }
+  return any;
+}
+
+void vga_upload_stat(uint64_t *pixel) {
+  *pixel = nr_upload_pixel;
+}
+
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 
@@ -56,37 +107,257 @@ static void init_screen() {
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static void *upload_src = NULL;
+
+static void upload_band(int y, int h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  SDL_UpdateTexture(texture, &rect, (uint8_t *)upload_src + y * screen_pitch(), screen_pitch());
+  nr_upload_pixel += (uint64_t)SCREEN_W * h;
+}
+
+static void present_screen(void *pixels, bool *rows) {
+  upload_src = pixels;
+  if (!for_each_dirty_band(rows, upload_band)) return;
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
+
+#ifdef CONFIG_SDL_IO_THREAD
+#include <pthread.h>
+
+/* The window is owned by the I/O thread (see device.c). vmem is double
+ * buffered with `frame', which is guarded by `frame_lock'. The CPU thread
+ * copies the dirty scanlines to `frame' only if the lock is free, so it
+ * never waits for the I/O thread. Otherwise the screen is updated again
+ * at the next device update. The I/O thread only holds the lock to copy
+ * the dirty scanlines to its own `present_frame', and uploads and presents
+ * them after releasing the lock, since presenting may wait for vsync.
+ */
+static uint32_t *frame = NULL;
+static bool *frame_row_dirty = NULL;
+static pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t *present_frame = NULL;
+static bool *present_row_dirty = NULL;
+
+static void copy_band(int y, int h) {
+  memcpy((uint8_t *)frame + y * screen_pitch(), (uint8_t *)vmem + y * screen_pitch(),
+      h * screen_pitch());
+  memset(frame_row_dirty + y, true, h);
+}
+
+static bool update_screen() {
+  if (pthread_mutex_trylock(&frame_lock) != 0) return false;
+  for_each_dirty_band(row_dirty, copy_band);
+  pthread_mutex_unlock(&frame_lock);
+  return true;
+}
+
+static void take_band(int y, int h) {
+  memcpy((uint8_t *)present_frame + y * screen_pitch(), (uint8_t *)frame + y * screen_pitch(),
+      h * screen_pitch());
+  memset(present_row_dirty + y, true, h);
+}
+
+static void init_frame() {
+  frame = (uint32_t *)calloc(1, screen_size());
+  frame_row_dirty = (bool *)calloc(screen_height(), sizeof(bool));
+  present_frame = (uint32_t *)calloc(1, screen_size());
+  present_row_dirty = (bool *)calloc(screen_height(), sizeof(bool));
+  assert(frame && frame_row_dirty && present_frame && present_row_dirty);
+}
+
+// called by the I/O thread
+void vga_init_screen() { init_screen(); }
+
+// called by the I/O thread
+void vga_present_screen() {
+  pthread_mutex_lock(&frame_lock);
+  for_each_dirty_band(frame_row_dirty, take_band);
+  pthread_mutex_unlock(&frame_lock);
+  present_screen(present_frame, present_row_dirty);
+}
+#else
+static bool update_screen() {
+  present_screen(vmem, row_dirty);
+  return true;
+}
+#endif
 #else
 static void init_screen() {}
 
-static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+static void upload_band(int y, int h) {
+  io_write(AM_GPU_FBDRAW, 0, y, (uint8_t *)vmem + y * screen_pitch(), screen_width(), h, true);
+  nr_upload_pixel += (uint64_t)screen_width() * h;
+}
+
+static bool update_screen() {
+  for_each_dirty_band(row_dirty, upload_band);
+  return true;
+}
+#endif
+#endif
+
+#ifdef CONFIG_VGA_HEADLESS
+#include <device/event.h>
+
+/* Frames are streamed to CONFIG_VGA_HEADLESS_FILE on every write to the
+ * sync register. The conversion loops have a constant trip count and no
+ * dependence between pixels, so that the compiler is free to vectorize them.
+ */
+#define NR_PIXEL (SCREEN_W * SCREEN_H)
+
+static FILE *frame_fp = NULL, *hash_fp = NULL;
+static uint8_t *frame_buf = NULL;
+static uint64_t last_hash = 0;
+static uint64_t nr_frame = 0;
+
+static uint64_t hash_frame(const uint32_t *p) {
+  // FNV-1a on pixels
+  uint64_t h = 0xcbf29ce484222325ull;
+  int i;
+  for (i = 0; i < NR_PIXEL; i ++) { h = (h ^ p[i]) * 0x100000001b3ull; }
+  return h;
+}
+
+#ifdef CONFIG_VGA_HEADLESS_Y4M
+// ARGB8888 to full range BT.601 YUV planes
+static void convert_frame(uint8_t *restrict out, const uint32_t *restrict in) {
+  uint8_t *restrict y = out, *restrict u = out + NR_PIXEL, *restrict v = out + 2 * NR_PIXEL;
+  int i;
+  for (i = 0; i < NR_PIXEL; i ++) {
+    int r = (in[i] >> 16) & 0xff, g = (in[i] >> 8) & 0xff, b = in[i] & 0xff;
+    y[i] = (77 * r + 150 * g + 29 * b) >> 8;
+    u[i] = ((-43 * r - 85 * g + 128 * b) >> 8) + 128;
+    v[i] = ((128 * r - 107 * g - 21 * b) >> 8) + 128;
+  }
+}
+
+static void write_header() {
+  fprintf(frame_fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444 XCOLORRANGE=FULL\n",
+      SCREEN_W, SCREEN_H, TIMER_HZ);
+}
+
+static void write_frame() {
+  fputs("FRAME\n", frame_fp);
+  fwrite(frame_buf, 3 * NR_PIXEL, 1, frame_fp);
+}
+#else
+// ARGB8888 to packed RGB, 4 pixels into 3 words at a time
+static void convert_frame(uint8_t *restrict out, const uint32_t *restrict in) {
+  uint32_t *restrict o = (uint32_t *)out;
+  int i;
+  for (i = 0; i < NR_PIXEL / 4; i ++) {
+    // R, G and B from the lowest byte
+    uint32_t q0 = __builtin_bswap32(in[4 * i + 0]) >> 8;
+    uint32_t q1 = __builtin_bswap32(in[4 * i + 1]) >> 8;
+    uint32_t q2 = __builtin_bswap32(in[4 * i + 2]) >> 8;
+    uint32_t q3 = __builtin_bswap32(in[4 * i + 3]) >> 8;
+    o[3 * i + 0] = q0 | (q1 << 24);
+    o[3 * i + 1] = (q1 >> 8) | (q2 << 16);
+    o[3 * i + 2] = (q2 >> 16) | (q3 << 8);
+  }
+}
+
+static void write_header() {}
+
+static void write_frame() {
+  fprintf(frame_fp, "P6\n%d %d\n255\n", SCREEN_W, SCREEN_H);
+  fwrite(frame_buf, 3 * NR_PIXEL, 1, frame_fp);
 }
 #endif
+
+#ifdef CONFIG_VGA_HEADLESS_DEDUP
+// Return whether vmem is written since the last call.
+static bool vmem_written() {
+  int n = nr_vmem_dirty(), i;
+  bool ret = false;
+  for (i = 0; i < n; i ++) { ret |= vmem_dirty[i]; }
+  if (ret) memset(vmem_dirty, 0, n);
+  return ret;
+}
+#endif
+
+static void capture_frame() {
+#ifdef CONFIG_VGA_HEADLESS_DEDUP
+  if (!vmem_written() && nr_frame > 0) return;
+#endif
+  uint64_t h = hash_frame(vmem);
+#ifdef CONFIG_VGA_HEADLESS_DEDUP
+  if (h == last_hash && nr_frame > 0) return;
+#endif
+  convert_frame(frame_buf, vmem);
+  write_frame();
+  fprintf(hash_fp, "%" PRIu64 " %016" PRIx64 "\n", g_nr_guest_inst, h);
+  last_hash = h;
+  nr_frame ++;
+}
+
+static void vgactl_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == 4 && vgactl_port_base[1] != 0) {
+    capture_frame();
+    vgactl_port_base[1] = 0;
+  }
+}
+
+static void init_headless() {
+  const char *path = CONFIG_VGA_HEADLESS_FILE;
+  frame_fp = fopen(path, "w");
+  Assert(frame_fp, "Can not open '%s'", path);
+  char hash_path[strlen(path) + 8];
+  sprintf(hash_path, "%s.hash", path);
+  hash_fp = fopen(hash_path, "w");
+  Assert(hash_fp, "Can not open '%s'", hash_path);
+  frame_buf = malloc(3 * NR_PIXEL);
+  assert(frame_buf);
+  write_header();
+  Log("Frames are written to %s", path);
+}
 #endif
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
+  // call `update_screen()` when the sync register is non-zero,
   // then zero out the sync register
+  if (vgactl_port_base[1] == 0 && !redraw) return;
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  collect_dirty_rows();
+  if (!update_screen()) return;
+#endif
+  vgactl_port_base[1] = 0;
+  redraw = false;
+}
+
+#ifdef CONFIG_SNAPSHOT
+// vmem is restored without the map, so draw the whole screen again
+static void vga_restore() {
+  memset(vmem_dirty, true, nr_vmem_dirty());
+  redraw = true;
 }
+#endif
 
 void init_vga() {
   vgactl_port_base = (uint32_t *)new_space(8);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
+  io_callback_t vgactl_handler = MUXDEF(CONFIG_VGA_HEADLESS, vgactl_io_handler, NULL);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, vgactl_handler);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, vgactl_handler);
 #endif
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  vmem_dirty = (bool *)calloc(nr_vmem_dirty(), sizeof(bool));
+  assert(vmem_dirty);
+  add_mmio_ram_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), vmem_dirty, VMEM_DIRTY_SHIFT);
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  row_dirty = (bool *)calloc(screen_height(), sizeof(bool));
+  assert(row_dirty);
+  MUXDEF(CONFIG_SDL_IO_THREAD, init_frame(), init_screen());
+  memset(vmem, 0, screen_size());
+#endif
+#ifdef CONFIG_VGA_HEADLESS
+  memset(vmem, 0, screen_size());
+  init_headless();
+#endif
+  IFDEF(CONFIG_SNAPSHOT, snapshot_register_restore(vga_restore));
 }
@@ -16,11 +16,16 @@
 #include <cpu/cpu.h>
 
 void sdb_mainloop();
+bool server_mode();
+void server_mainloop();
 
 void engine_start() {
 #ifdef CONFIG_TARGET_AM
   cpu_exec(-1);
 #else
+  /* Run images requested by clients if started as a fork server. */
+  if (server_mode()) { server_mainloop(); return; }
+
   /* Receive commands from user. */
   sdb_mainloop();
 #endif
@@ -0,0 +1,378 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/jit.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#ifndef __x86_64__
+#error "the JIT only generates x86-64 code"
+#endif
+
+// The JIT translates hot riscv32 basic blocks into x86-64 code.
+// A translated block is called as `uint32_t block(CPU_state *s)`.
+// It keeps `s` in %rbx, updates the guest registers in `s`, sets
+// `s->pc` to the pc of the next block, and returns the number of
+// guest instructions executed. %eax, %ecx, %edx, %esi and %edi are
+// scratch registers.
+
+#define CODE_CACHE_SIZE (16 * 1024 * 1024)
+#define CODE_PAGE_SHIFT 12
+#define NR_ENTRY (1 << 16)
+#define MAX_BLOCK_LEN 64
+#define MAX_INST_CODE 128 // upper bound of the host code size of a guest instruction
+#define HOST_PAGE_SIZE 4096
+#define NR_GPR MUXDEF(CONFIG_RVE, 16, 32)
+
+typedef uint32_t (*JitBlock)(CPU_state *s);
+
+typedef struct {
+  vaddr_t pc;
+  int count; // execution count before translated, -1 if not translatable
+  int ninst;
+  JitBlock code;
+} JitEntry;
+
+static JitEntry entry[NR_ENTRY] = {};
+static uint8_t *code_cache = NULL;
+static uint8_t *code_ptr = NULL;
+// pages holding translated instructions, stores to them take the slow path
+static uint8_t code_page[CONFIG_MSIZE >> CODE_PAGE_SHIFT] = {};
+
+static uint64_t nr_block = 0, nr_jit_inst = 0;
+
+bool jit_stale = false;
+uint8_t jit_code_map[CONFIG_MSIZE / 4 / 8] = {};
+
+enum { EAX = 0, ECX = 1, EDX = 2, EBX = 3, ESI = 6, EDI = 7 };
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+enum { SFT_SHL = 4, SFT_SHR = 5, SFT_SAR = 7 };
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_L = 0xc, CC_GE = 0xd };
+
+// --- x86-64 code emitter ---
+static void emit8(uint8_t b) { *code_ptr ++ = b; }
+static void emit32(uint32_t w) { memcpy(code_ptr, &w, 4); code_ptr += 4; }
+static void emit64(uint64_t w) { memcpy(code_ptr, &w, 8); code_ptr += 8; }
+
+#define GPR_DISP(i) ((uint32_t)offsetof(CPU_state, gpr[0]) + (i) * sizeof(word_t))
+#define PC_DISP     ((uint32_t)offsetof(CPU_state, pc))
+
+// op r32, [rbx + disp32]
+static void emit_rm_rbx(uint8_t op, int r, uint32_t disp) {
+  emit8(op); emit8(0x80 | (r << 3) | EBX); emit32(disp);
+}
+static void load_gpr(int r, int idx) {
+  if (idx == 0) { emit8(0x31); emit8(0xc0 | (r << 3) | r); } // xor r, r
+  else emit_rm_rbx(0x8b, r, GPR_DISP(idx));
+}
+static void store_gpr(int idx, int r) {
+  if (idx != 0) emit_rm_rbx(0x89, r, GPR_DISP(idx));
+}
+static void store_gpr_imm(int idx, uint32_t imm) {
+  if (idx == 0) return;
+  emit8(0xc7); emit8(0x80 | EBX); emit32(GPR_DISP(idx)); emit32(imm);
+}
+static void emit_mov_rr(int dst, int src) { emit8(0x89); emit8(0xc0 | (src << 3) | dst); }
+static void emit_mov_imm32(int r, uint32_t imm) { emit8(0xb8 + r); emit32(imm); }
+static void emit_mov_imm64(int r, uint64_t imm) { emit8(0x48); emit8(0xb8 + r); emit64(imm); }
+static void emit_alu_rr(int op, int dst, int src) { emit8((op << 3) | 0x01); emit8(0xc0 | (src << 3) | dst); }
+static void emit_alu_imm(int op, int r, uint32_t imm) { emit8(0x81); emit8(0xc0 | (op << 3) | r); emit32(imm); }
+static void emit_shift_imm(int op, int r, uint8_t imm) { emit8(0xc1); emit8(0xc0 | (op << 3) | r); emit8(imm); }
+static void emit_shift_cl(int op, int r) { emit8(0xd3); emit8(0xc0 | (op << 3) | r); }
+static void emit_setcc_eax(int cc) {
+  emit8(0x0f); emit8(0x90 | cc); emit8(0xc0);     // setcc al
+  emit8(0x0f); emit8(0xb6); emit8(0xc0);          // movzx eax, al
+}
+static void emit_call(void *fn) { emit_mov_imm64(EAX, (uintptr_t)fn); emit8(0xff); emit8(0xd0); }
+
+// return the address of the rel32 field to patch
+static uint8_t* emit_jcc(int cc) { emit8(0x0f); emit8(0x80 | cc); emit32(0); return code_ptr - 4; }
+static uint8_t* emit_jmp() { emit8(0xe9); emit32(0); return code_ptr - 4; }
+static void patch_rel32(uint8_t *p) { int32_t rel = code_ptr - (p + 4); memcpy(p, &rel, 4); }
+
+static void emit_prologue() {
+  emit8(0x53);                                    // push rbx
+  emit8(0x48); emit8(0x89); emit8(0xfb);          // mov rbx, rdi
+}
+
+static void emit_exit(vaddr_t pc, int ninst) {
+  emit8(0xc7); emit8(0x80 | EBX); emit32(PC_DISP); emit32(pc);
+  emit_mov_imm32(EAX, ninst);
+  emit8(0x5b);                                    // pop rbx
+  emit8(0xc3);                                    // ret
+}
+
+// the exit whose target pc is in %eax
+static void emit_exit_eax(int ninst) {
+  emit_rm_rbx(0x89, EAX, PC_DISP);
+  emit_mov_imm32(EAX, ninst);
+  emit8(0x5b);
+  emit8(0xc3);
+}
+
+// --- memory access ---
+static bool jit_store(vaddr_t addr, int len, word_t data) {
+  vaddr_write(addr, len, data);
+  return jit_stale;
+}
+
+// %eax = guest address, the result is zero-extended into %eax
+static void emit_load(int len) {
+  emit_mov_rr(ECX, EAX);
+  emit_alu_imm(ALU_SUB, ECX, CONFIG_MBASE);
+  emit_alu_imm(ALU_CMP, ECX, CONFIG_MSIZE - len);
+  uint8_t *slow = emit_jcc(CC_A);
+  emit_mov_imm64(EDX, (uintptr_t)guest_to_host(CONFIG_MBASE));
+  switch (len) {                                  // mov/movzx eax, [rdx + rcx]
+    case 1: emit8(0x0f); emit8(0xb6); break;
+    case 2: emit8(0x0f); emit8(0xb7); break;
+    case 4: emit8(0x8b); break;
+  }
+  emit8(0x04); emit8(0x0a);
+  uint8_t *done = emit_jmp();
+  patch_rel32(slow);
+  // MMIO or out of bound, let vaddr_read() handle it
+  emit_mov_rr(EDI, EAX);
+  emit_mov_imm32(ESI, len);
+  emit_call(vaddr_read);
+  patch_rel32(done);
+}
+
+// %eax = guest address, %edx = data
+static void emit_store(int len, vaddr_t next_pc, int ninst) {
+  emit_mov_rr(ECX, EAX);
+  emit_alu_imm(ALU_SUB, ECX, CONFIG_MBASE);
+  emit_alu_imm(ALU_CMP, ECX, CONFIG_MSIZE - len);
+  uint8_t *slow = emit_jcc(CC_A);
+  emit_mov_rr(ESI, ECX);
+  emit_shift_imm(SFT_SHR, ESI, CODE_PAGE_SHIFT);
+  emit_mov_imm64(EDI, (uintptr_t)code_page);
+  emit8(0x80); emit8(0x3c); emit8(0x37); emit8(0); // cmp byte [rdi + rsi], 0
+  uint8_t *slow2 = emit_jcc(CC_NE);
+  emit_mov_imm64(ESI, (uintptr_t)guest_to_host(CONFIG_MBASE));
+  switch (len) {                                  // mov [rsi + rcx], dl/dx/edx
+    case 1: emit8(0x88); break;
+    case 2: emit8(0x66); emit8(0x89); break;
+    case 4: emit8(0x89); break;
+  }
+  emit8(0x14); emit8(0x0e);
+  uint8_t *done = emit_jmp();
+  patch_rel32(slow);
+  patch_rel32(slow2);
+  // MMIO, out of bound, or the page holds translated code
+  emit_mov_rr(EDI, EAX);
+  emit_mov_imm32(ESI, len);
+  emit_call(jit_store);
+  emit8(0x84); emit8(0xc0);                       // test al, al
+  uint8_t *not_stale = emit_jcc(CC_E);
+  emit_exit(next_pc, ninst);
+  patch_rel32(not_stale);
+  patch_rel32(done);
+}
+
+// --- translation ---
+static inline void mark_code(vaddr_t pc) {
+  paddr_t off = pc - CONFIG_MBASE;
+  jit_code_map[off / 4 / 8] |= 1 << (off / 4 % 8);
+  code_page[off >> CODE_PAGE_SHIFT] = 1;
+}
+
+// Translate the instruction at `pc`, which is the `ninst`-th
+// instruction of the block. Return false if it is not supported,
+// before any code is emitted for it.
+// `*end` is set if the instruction ends the block.
+static bool translate_inst(vaddr_t pc, int ninst, bool *end) {
+  uint32_t i = vaddr_ifetch(pc, 4);
+  int opcode = BITS(i, 6, 0);
+  int rd  = BITS(i, 11, 7);
+  int rs1 = BITS(i, 19, 15);
+  int rs2 = BITS(i, 24, 20);
+  int funct3 = BITS(i, 14, 12);
+  int funct7 = BITS(i, 31, 25);
+  word_t immI = SEXT(BITS(i, 31, 20), 12);
+  word_t immS = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7);
+  word_t immB = (SEXT(BITS(i, 31, 31), 1) << 12) | (BITS(i, 7, 7) << 11) |
+                (BITS(i, 30, 25) << 5) | (BITS(i, 11, 8) << 1);
+  word_t immU = BITS(i, 31, 12) << 12;
+  word_t immJ = (SEXT(BITS(i, 31, 31), 1) << 20) | (BITS(i, 19, 12) << 12) |
+                (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1);
+  static const int branch_cc[8] = { CC_E, CC_NE, -1, -1, CC_L, CC_GE, CC_B, CC_AE };
+  static const int alu_op[8] = { ALU_ADD, SFT_SHL, -1, -1, ALU_XOR, SFT_SHR, ALU_OR, ALU_AND };
+
+  if (rd >= NR_GPR || rs1 >= NR_GPR || rs2 >= NR_GPR) return false;
+  *end = false;
+
+  switch (opcode) {
+    case 0x37: store_gpr_imm(rd, immU); break;                  // lui
+    case 0x17: store_gpr_imm(rd, pc + immU); break;             // auipc
+    case 0x6f:                                                  // jal
+      store_gpr_imm(rd, pc + 4);
+      emit_exit(pc + immJ, ninst + 1);
+      *end = true;
+      break;
+    case 0x67:                                                  // jalr
+      if (funct3 != 0) return false;
+      load_gpr(EAX, rs1);
+      emit_alu_imm(ALU_ADD, EAX, immI);
+      emit_alu_imm(ALU_AND, EAX, ~1u);
+      store_gpr_imm(rd, pc + 4);
+      emit_exit_eax(ninst + 1);
+      *end = true;
+      break;
+    case 0x63: {                                                // branch
+      if (branch_cc[funct3] == -1) return false;
+      load_gpr(EAX, rs1);
+      load_gpr(ECX, rs2);
+      emit_alu_rr(ALU_CMP, EAX, ECX);
+      uint8_t *taken = emit_jcc(branch_cc[funct3]);
+      emit_exit(pc + 4, ninst + 1);
+      patch_rel32(taken);
+      emit_exit(pc + immB, ninst + 1);
+      *end = true;
+      break;
+    }
+    case 0x03:                                                  // load
+      if (funct3 == 3 || funct3 >= 6) return false;
+      load_gpr(EAX, rs1);
+      emit_alu_imm(ALU_ADD, EAX, immI);
+      emit_load(1 << (funct3 & 3));
+      if (funct3 == 0) { emit8(0x0f); emit8(0xbe); emit8(0xc0); } // movsx eax, al
+      if (funct3 == 1) { emit8(0x0f); emit8(0xbf); emit8(0xc0); } // movsx eax, ax
+      store_gpr(rd, EAX);
+      break;
+    case 0x23:                                                  // store
+      if (funct3 >= 3) return false;
+      load_gpr(EAX, rs1);
+      emit_alu_imm(ALU_ADD, EAX, immS);
+      load_gpr(EDX, rs2);
+      emit_store(1 << funct3, pc + 4, ninst + 1);
+      break;
+    case 0x13:                                                  // alu with imm
+      if (funct3 == 1 && funct7 != 0) return false;
+      if (funct3 == 5 && funct7 != 0 && funct7 != 0x20) return false;
+      load_gpr(EAX, rs1);
+      switch (funct3) {
+        case 2: emit_alu_imm(ALU_CMP, EAX, immI); emit_setcc_eax(CC_L); break; // slti
+        case 3: emit_alu_imm(ALU_CMP, EAX, immI); emit_setcc_eax(CC_B); break; // sltiu
+        case 1: emit_shift_imm(SFT_SHL, EAX, rs2); break;       // slli
+        case 5: emit_shift_imm(funct7 ? SFT_SAR : SFT_SHR, EAX, rs2); break; // srli, srai
+        default: emit_alu_imm(alu_op[funct3], EAX, immI); break;
+      }
+      store_gpr(rd, EAX);
+      break;
+    case 0x33:                                                  // alu with registers
+      if (funct7 != 0 && !(funct7 == 0x20 && (funct3 == 0 || funct3 == 5))) return false;
+      load_gpr(EAX, rs1);
+      load_gpr(ECX, rs2);
+      switch (funct3) {
+        case 0: emit_alu_rr(funct7 ? ALU_SUB : ALU_ADD, EAX, ECX); break;
+        case 1: emit_shift_cl(SFT_SHL, EAX); break;
+        case 2: emit_alu_rr(ALU_CMP, EAX, ECX); emit_setcc_eax(CC_L); break;
+        case 3: emit_alu_rr(ALU_CMP, EAX, ECX); emit_setcc_eax(CC_B); break;
+        case 5: emit_shift_cl(funct7 ? SFT_SAR : SFT_SHR, EAX); break;
+        default: emit_alu_rr(alu_op[funct3], EAX, ECX); break;
+      }
+      store_gpr(rd, EAX);
+      break;
+    case 0x0f:                                                  // fence
+      if (funct3 != 0) return false;
+      break;
+    default: return false; // system instructions and extensions are left to the interpreter
+  }
+  mark_code(pc);
+  return true;
+}
+
+static void jit_flush() {
+  memset(entry, 0, sizeof(entry));
+  memset(code_page, 0, sizeof(code_page));
+  memset(jit_code_map, 0, sizeof(jit_code_map));
+  code_ptr = code_cache;
+  jit_stale = false;
+}
+
+// The code cache is never writable and executable at the same time.
+// The pages to emit a block into are writable only during translation.
+static void code_cache_protect(uint8_t *start, int prot) {
+  uintptr_t l = ROUNDDOWN(start, HOST_PAGE_SIZE);
+  uintptr_t r = ROUNDUP(start + MAX_BLOCK_LEN * MAX_INST_CODE, HOST_PAGE_SIZE);
+  Assert(mprotect((void *)l, r - l, prot) == 0, "fail to protect the code cache");
+}
+
+static void translate(JitEntry *e) {
+  if (code_ptr + MAX_BLOCK_LEN * MAX_INST_CODE > code_cache + CODE_CACHE_SIZE) {
+    vaddr_t pc = e->pc;
+    jit_flush();
+    e->pc = pc;
+  }
+
+  uint8_t *start = code_ptr;
+  code_cache_protect(start, PROT_READ | PROT_WRITE);
+  emit_prologue();
+  vaddr_t pc = e->pc;
+  bool end = false;
+  int n;
+  for (n = 0; n < MAX_BLOCK_LEN && !end && in_pmem(pc) && in_pmem(pc + 3); n ++, pc += 4) {
+    if (!translate_inst(pc, n, &end)) break;
+  }
+  if (n == 0) {
+    code_ptr = start;
+    e->count = -1;
+  } else {
+    if (!end) emit_exit(pc, n);
+    e->code = (JitBlock)start;
+    e->ninst = n;
+    nr_block ++;
+  }
+  code_cache_protect(start, PROT_READ | PROT_EXEC);
+}
+
+// Execute the block starting from `pc` if it is translated and
+// no longer than `n` instructions. Return the number of executed
+// instructions, or 0 to let the interpreter execute the instruction.
+uint64_t jit_exec(vaddr_t pc, uint64_t n) {
+  if (jit_stale) jit_flush();
+  JitEntry *e = &entry[(pc / 4) & (NR_ENTRY - 1)];
+  if (e->pc != pc) {
+    e->pc = pc;
+    e->count = 0;
+    e->code = NULL;
+  }
+  if (e->code == NULL) {
+    if (e->count < 0 || ++ e->count < CONFIG_JIT_THRESHOLD) return 0;
+    translate(e);
+    if (e->code == NULL) return 0;
+  }
+  if (e->ninst > n) return 0;
+  uint32_t ret = e->code(&cpu);
+  nr_jit_inst += ret;
+  return ret;
+}
+
+void jit_stat(uint64_t *block, uint64_t *inst) {
+  *block = nr_block;
+  *inst = nr_jit_inst;
+}
+
+void init_jit() {
+  code_cache = mmap(NULL, CODE_CACHE_SIZE, PROT_READ | PROT_EXEC,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  Assert(code_cache != MAP_FAILED, "fail to allocate the code cache for JIT");
+  code_ptr = code_cache;
+  Log("JIT code cache = %p, size = %d MB", code_cache, CODE_CACHE_SIZE / 1024 / 1024);
+}
@@ -0,0 +1,114 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/tcache.h>
+#include <memory/paddr.h>
+
+#define HASH_NR_SLOT (TCACHE_NR_BLOCK * 2)
+
+static TBlock block_pool[TCACHE_NR_BLOCK] = {};
+static DecodeCache inst_pool[TCACHE_NR_INST] = {};
+static TBlock *hash_table[HASH_NR_SLOT] = {};
+static int nr_block = 0;
+static int nr_inst = 0;
+
+bool tcache_stale = false;
+uint8_t tcache_code_map[CONFIG_MSIZE / DCACHE_INST_ALIGN / 8] = {};
+
+static inline uint32_t hash(vaddr_t pc) {
+  return (pc / DCACHE_INST_ALIGN) & (HASH_NR_SLOT - 1);
+}
+
+static inline void set_code(paddr_t addr, bool is_code) {
+  paddr_t idx = (addr - CONFIG_MBASE) / DCACHE_INST_ALIGN;
+  if (is_code) tcache_code_map[idx / 8] |=  (1 << (idx % 8));
+  else         tcache_code_map[idx / 8] &= ~(1 << (idx % 8));
+}
+
+// Only the entries in use are cleared, since self-modifying
+// code may flush the cache frequently.
+void tcache_flush() {
+  int i;
+  for (i = 0; i < nr_block; i ++) { hash_table[hash(block_pool[i].pc)] = NULL; }
+  for (i = 0; i < nr_inst; i ++) { set_code(inst_pool[i].pc, false); }
+  nr_block = 0;
+  nr_inst = 0;
+  tcache_stale = false;
+}
+
+static TBlock* tcache_find(vaddr_t pc) {
+  TBlock *tb;
+  for (tb = hash_table[hash(pc)]; tb != NULL; tb = tb->hash_next) {
+    if (tb->pc == pc) return tb;
+  }
+  return NULL;
+}
+
+static TBlock* tcache_new(vaddr_t pc) {
+  TBlock *tb = &block_pool[nr_block ++];
+  tb->pc = pc;
+  tb->nr_inst = 0;
+  tb->sealed = false;
+  // the only unsealed block takes the free instructions
+  // in the pool, which are reserved in tcache_next()
+  tb->inst = &inst_pool[nr_inst];
+  tb->succ[0] = tb->succ[1] = NULL;
+  uint32_t h = hash(pc);
+  tb->hash_next = hash_table[h];
+  hash_table[h] = tb;
+  return tb;
+}
+
+// Return the block starting from `pc`, which is going to be executed
+// after `prev`. The successors of `prev` are checked first, so the
+// hash table is only looked up when the exit of `prev` is not chained.
+TBlock* tcache_next(TBlock *prev, vaddr_t pc) {
+  if (prev != NULL) {
+    TBlock *tb = tcache_chained(prev, pc);
+    if (tb != NULL) return tb;
+  }
+
+  TBlock *tb = tcache_find(pc);
+  if (tb == NULL) {
+    if (nr_block == TCACHE_NR_BLOCK || nr_inst + TCACHE_BLOCK_LEN > TCACHE_NR_INST) {
+      tcache_flush();
+      prev = NULL;
+    }
+    tb = tcache_new(pc);
+  }
+
+  if (prev != NULL) {
+    int i = (prev->succ[0] == NULL ? 0 : 1);
+    prev->succ_pc[i] = pc;
+    prev->succ[i] = tb;
+  }
+  return tb;
+}
+
+// Append an instruction at `pc` to the block which is being recorded.
+// Return NULL if the block can not grow any more.
+DecodeCache* tcache_record(TBlock *tb, vaddr_t pc) {
+  if (tb->sealed) return NULL;
+  if (tb->nr_inst == TCACHE_BLOCK_LEN || !in_pmem(pc)) {
+    tb->sealed = true;
+    return NULL;
+  }
+  set_code(pc, true);
+  DecodeCache *dc = &tb->inst[tb->nr_inst ++];
+  nr_inst ++;
+  dc->pc = pc;
+  dc->handler = NULL;
+  return dc;
+}
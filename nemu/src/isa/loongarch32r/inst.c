@@ -39,8 +39,30 @@ static void decode_operand(Decode *s, int *rd_, word_t *src1, word_t *src2, word
     case TYPE_1RI20: simm20(); src1R(); break;
     case TYPE_2RI12: simm12(); src1R(); break;
   }
+  dcache_save_operand(s, type, *rd_, rj, 0, *imm);
 }
 
+#ifdef CONFIG_DECODE_CACHE
+static void decode_operand_cached(DecodeCache *dc, int *rd_, word_t *src1, word_t *src2, word_t *imm) {
+  int rj = dc->rs1;
+  *rd_ = dc->rd;
+  *imm = dc->imm;
+  switch (dc->type) {
+    case TYPE_1RI20: src1R(); break;
+    case TYPE_2RI12: src1R(); break;
+  }
+}
+#endif
+
+#ifdef CONFIG_DECODE_TREE
+// the longest opcode of the instructions with immediates
+#define INSTPAT_TREE_MASK 0xfff00000
+static int decode_tree_index(uint32_t i) {
+  return BITS(i, 31, 20);
+}
+#define INSTPAT_TREE_INDEX decode_tree_index
+#endif
+
 static int decode_exec(Decode *s) {
   int rd = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
@@ -49,24 +71,60 @@ static int decode_exec(Decode *s) {
 #define INSTPAT_INST(s) ((s)->isa.inst.val)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
   decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  INSTPAT_CACHE(s); \
   __VA_ARGS__ ; \
 }
 
+#ifdef CONFIG_DECODE_CACHE
+  if (dcache_hit(s)) {
+    IFDEF(CONFIG_ENGINE_TCACHE, INSTPAT_BLOCK_LABEL:)
+    decode_operand_cached(s->dc, &rd, &src1, &src2, &imm);
+    goto *(s->dc->handler);
+  }
+#endif
+
   INSTPAT_START();
   INSTPAT("0001110 ????? ????? ????? ????? ?????" , pcaddu12i, 1RI20 , R(rd) = s->pc + imm);
-  INSTPAT("0010100010 ???????????? ????? ?????"   , ld.w     , 2RI12 , R(rd) = Mr(src1 + imm, 4));
-  INSTPAT("0010100110 ???????????? ????? ?????"   , st.w     , 2RI12 , Mw(src1 + imm, 4, R(rd)));
+  INSTPAT("0010100010 ???????????? ????? ?????"   , ld.w     , 2RI12 , R(rd) = vaddr_read32(src1 + imm));
+  INSTPAT("0010100110 ???????????? ????? ?????"   , st.w     , 2RI12 , vaddr_write32(src1 + imm, R(rd)));
 
   INSTPAT("0000 0000 0010 10100 ????? ????? ?????", break    , N     , NEMUTRAP(s->pc, R(4))); // R(4) is $a0
   INSTPAT("????????????????? ????? ????? ?????"   , inv      , N     , INV(s->pc));
   INSTPAT_END();
 
   R(0) = 0; // reset $zero to 0
+  INSTPAT_BLOCK_NEXT(s);
 
   return 0;
 }
 
 int isa_exec_once(Decode *s) {
+#ifdef CONFIG_DECODE_CACHE
+  if (dcache_hit(s)) {
+    s->isa = s->dc->isa;
+    s->snpc = s->dc->snpc;
+    return decode_exec(s);
+  }
+#endif
   s->isa.inst.val = inst_fetch(&s->snpc, 4);
   return decode_exec(s);
 }
+
+#ifdef CONFIG_ENGINE_TCACHE
+int isa_exec_block(Decode *s, DecodeCache *dc, int n) {
+  s->dc = dc;
+  s->dc_end = dc + n;
+  s->pc = dc->pc;
+  s->snpc = dc->snpc;
+  s->isa = dc->isa;
+  decode_exec(s);
+  return s->dc - dc;
+}
+
+bool isa_inst_ends_block(Decode *s) {
+  // the branches, jirl, b, bl, break and syscall
+  uint32_t i = s->isa.inst.val;
+  uint32_t opcode = BITS(i, 31, 26);
+  return (opcode >= 0x10 && opcode <= 0x1b) || BITS(i, 31, 17) == 0x0015;
+}
+#endif
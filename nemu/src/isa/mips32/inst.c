@@ -41,8 +41,30 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
     case TYPE_I: src1R(); immI(); break;
     case TYPE_U: src1R(); immU(); break;
   }
+  dcache_save_operand(s, type, *rd, rs, rt, *imm);
 }
 
+#ifdef CONFIG_DECODE_CACHE
+static void decode_operand_cached(DecodeCache *dc, int *rd, word_t *src1, word_t *src2, word_t *imm) {
+  int rs = dc->rs1;
+  *rd  = dc->rd;
+  *imm = dc->imm;
+  switch (dc->type) {
+    case TYPE_I: src1R(); break;
+    case TYPE_U: src1R(); break;
+  }
+}
+#endif
+
+#ifdef CONFIG_DECODE_TREE
+// opcode and funct
+#define INSTPAT_TREE_MASK 0xfc00003f
+static int decode_tree_index(uint32_t i) {
+  return BITS(i, 5, 0) | (BITS(i, 31, 26) << 6);
+}
+#define INSTPAT_TREE_INDEX decode_tree_index
+#endif
+
 static int decode_exec(Decode *s) {
   int rd = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
@@ -51,24 +73,61 @@ static int decode_exec(Decode *s) {
 #define INSTPAT_INST(s) ((s)->isa.inst.val)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
   decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  INSTPAT_CACHE(s); \
   __VA_ARGS__ ; \
 }
 
+#ifdef CONFIG_DECODE_CACHE
+  if (dcache_hit(s)) {
+    IFDEF(CONFIG_ENGINE_TCACHE, INSTPAT_BLOCK_LABEL:)
+    decode_operand_cached(s->dc, &rd, &src1, &src2, &imm);
+    goto *(s->dc->handler);
+  }
+#endif
+
   INSTPAT_START();
   INSTPAT("001111 ????? ????? ????? ????? ??????", lui    , U, R(rd) = imm << 16);
-  INSTPAT("100011 ????? ????? ????? ????? ??????", lw     , I, R(rd) = Mr(src1 + imm, 4));
-  INSTPAT("101011 ????? ????? ????? ????? ??????", sw     , I, Mw(src1 + imm, 4, R(rd)));
+  INSTPAT("100011 ????? ????? ????? ????? ??????", lw     , I, R(rd) = vaddr_read32(src1 + imm));
+  INSTPAT("101011 ????? ????? ????? ????? ??????", sw     , I, vaddr_write32(src1 + imm, R(rd)));
 
   INSTPAT("011100 ????? ????? ????? ????? 111111", sdbbp  , N, NEMUTRAP(s->pc, R(2))); // R(2) is $v0;
   INSTPAT("?????? ????? ????? ????? ????? ??????", inv    , N, INV(s->pc));
   INSTPAT_END();
 
   R(0) = 0; // reset $zero to 0
+  INSTPAT_BLOCK_NEXT(s);
 
   return 0;
 }
 
 int isa_exec_once(Decode *s) {
+#ifdef CONFIG_DECODE_CACHE
+  if (dcache_hit(s)) {
+    s->isa = s->dc->isa;
+    s->snpc = s->dc->snpc;
+    return decode_exec(s);
+  }
+#endif
   s->isa.inst.val = inst_fetch(&s->snpc, 4);
   return decode_exec(s);
 }
+
+#ifdef CONFIG_ENGINE_TCACHE
+int isa_exec_block(Decode *s, DecodeCache *dc, int n) {
+  s->dc = dc;
+  s->dc_end = dc + n;
+  s->pc = dc->pc;
+  s->snpc = dc->snpc;
+  s->isa = dc->isa;
+  decode_exec(s);
+  return s->dc - dc;
+}
+
+bool isa_inst_ends_block(Decode *s) {
+  // j, jal, the branches, jr, jalr and the traps
+  uint32_t i = s->isa.inst.val;
+  uint32_t opcode = BITS(i, 31, 26), funct = BITS(i, 5, 0);
+  if (opcode == 0) return funct == 0x08 || funct == 0x09 || funct == 0x0c || funct == 0x0d;
+  return (opcode >= 0x01 && opcode <= 0x07) || (opcode >= 0x14 && opcode <= 0x17) || opcode == 0x1c;
+}
+#endif
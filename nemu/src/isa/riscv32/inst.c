@@ -23,7 +23,7 @@
 #define Mw vaddr_write
 
 enum {
-  TYPE_I, TYPE_U, TYPE_S,
+  TYPE_I, TYPE_U, TYPE_S, TYPE_R, TYPE_B, TYPE_J,
   TYPE_N, // none
 };
 
@@ -32,6 +32,10 @@ enum {
 #define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
 #define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
 #define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define immB() do { *imm = (SEXT(BITS(i, 31, 31), 1) << 12) | (BITS(i, 7, 7) << 11) | \
+                         (BITS(i, 30, 25) << 5) | (BITS(i, 11, 8) << 1); } while(0)
+#define immJ() do { *imm = (SEXT(BITS(i, 31, 31), 1) << 20) | (BITS(i, 19, 12) << 12) | \
+                         (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1); } while(0)
 
 static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
   uint32_t i = s->isa.inst.val;
@@ -44,9 +48,37 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
                   break;
     case TYPE_U:                   immU(); break;
     case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_R: src1R(); src2R();         break;
+    case TYPE_B: src1R(); src2R(); immB(); break;
+    case TYPE_J:                   immJ(); break;
   }
+  dcache_save_operand(s, type, *rd, rs1, rs2, *imm);
 }
 
+#ifdef CONFIG_DECODE_CACHE
+static void decode_operand_cached(DecodeCache *dc, int *rd, word_t *src1, word_t *src2, word_t *imm) {
+  int rs1 = dc->rs1;
+  int rs2 = dc->rs2;
+  *rd  = dc->rd;
+  *imm = dc->imm;
+  switch (dc->type) {
+    case TYPE_I: src1R();          break;
+    case TYPE_S: src1R(); src2R(); break;
+    case TYPE_R: src1R(); src2R(); break;
+    case TYPE_B: src1R(); src2R(); break;
+  }
+}
+#endif
+
+#ifdef CONFIG_DECODE_TREE
+// opcode[6:2], funct3 and the two bits distinguishing add/sub, srl/sra, mul
+#define INSTPAT_TREE_MASK 0x4200707c
+static int decode_tree_index(uint32_t i) {
+  return BITS(i, 6, 2) | (BITS(i, 14, 12) << 5) | (BITS(i, 25, 25) << 8) | (BITS(i, 30, 30) << 9);
+}
+#define INSTPAT_TREE_INDEX decode_tree_index
+#endif
+
 static int decode_exec(Decode *s) {
   int rd = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
@@ -55,24 +87,98 @@ static int decode_exec(Decode *s) {
 #define INSTPAT_INST(s) ((s)->isa.inst.val)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
   decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  INSTPAT_CACHE(s); \
   __VA_ARGS__ ; \
 }
 
+#ifdef CONFIG_DECODE_CACHE
+  if (dcache_hit(s)) {
+    IFDEF(CONFIG_ENGINE_TCACHE, INSTPAT_BLOCK_LABEL:)
+    decode_operand_cached(s->dc, &rd, &src1, &src2, &imm);
+    goto *(s->dc->handler);
+  }
+#endif
+
   INSTPAT_START();
+  INSTPAT("??????? ????? ????? ??? ????? 01101 11", lui    , U, R(rd) = imm);
   INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(rd) = s->pc + imm);
-  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
-  INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
-  INSTPAT("??????? ????? ????? 000 ????? 00100 11", addi   , I, R(rd) = R(src1)+imm);
+  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal    , J, R(rd) = s->snpc; s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr   , I, R(rd) = s->snpc; s->dnpc = (src1 + imm) & ~(word_t)1);
+
+  INSTPAT("??????? ????? ????? 000 ????? 11000 11", beq    , B, if (src1 == src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 001 ????? 11000 11", bne    , B, if (src1 != src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 100 ????? 11000 11", blt    , B, if ((sword_t)src1 <  (sword_t)src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 101 ????? 11000 11", bge    , B, if ((sword_t)src1 >= (sword_t)src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 110 ????? 11000 11", bltu   , B, if (src1 <  src2) s->dnpc = s->pc + imm);
+  INSTPAT("??????? ????? ????? 111 ????? 11000 11", bgeu   , B, if (src1 >= src2) s->dnpc = s->pc + imm);
+
+  INSTPAT("??????? ????? ????? 000 ????? 00000 11", lb     , I, R(rd) = SEXT(vaddr_read8(src1 + imm), 8));
+  INSTPAT("??????? ????? ????? 001 ????? 00000 11", lh     , I, R(rd) = SEXT(vaddr_read16(src1 + imm), 16));
+  INSTPAT("??????? ????? ????? 010 ????? 00000 11", lw     , I, R(rd) = SEXT(vaddr_read32(src1 + imm), 32));
+  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = vaddr_read8(src1 + imm));
+  INSTPAT("??????? ????? ????? 101 ????? 00000 11", lhu    , I, R(rd) = vaddr_read16(src1 + imm));
+  INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, vaddr_write8(src1 + imm, src2));
+  INSTPAT("??????? ????? ????? 001 ????? 01000 11", sh     , S, vaddr_write16(src1 + imm, src2));
+  INSTPAT("??????? ????? ????? 010 ????? 01000 11", sw     , S, vaddr_write32(src1 + imm, src2));
+
+  INSTPAT("??????? ????? ????? 000 ????? 00100 11", addi   , I, R(rd) = src1 + imm);
+  INSTPAT("??????? ????? ????? 010 ????? 00100 11", slti   , I, R(rd) = (sword_t)src1 < (sword_t)imm);
+  INSTPAT("??????? ????? ????? 011 ????? 00100 11", sltiu  , I, R(rd) = src1 < imm);
+  INSTPAT("??????? ????? ????? 100 ????? 00100 11", xori   , I, R(rd) = src1 ^ imm);
+  INSTPAT("??????? ????? ????? 110 ????? 00100 11", ori    , I, R(rd) = src1 | imm);
+  INSTPAT("??????? ????? ????? 111 ????? 00100 11", andi   , I, R(rd) = src1 & imm);
+  INSTPAT("0000000 ????? ????? 001 ????? 00100 11", slli   , I, R(rd) = src1 << BITS(imm, 4, 0));
+  INSTPAT("0000000 ????? ????? 101 ????? 00100 11", srli   , I, R(rd) = src1 >> BITS(imm, 4, 0));
+  INSTPAT("0100000 ????? ????? 101 ????? 00100 11", srai   , I, R(rd) = (sword_t)src1 >> BITS(imm, 4, 0));
+
+  INSTPAT("0000000 ????? ????? 000 ????? 01100 11", add    , R, R(rd) = src1 + src2);
+  INSTPAT("0100000 ????? ????? 000 ????? 01100 11", sub    , R, R(rd) = src1 - src2);
+  INSTPAT("0000000 ????? ????? 001 ????? 01100 11", sll    , R, R(rd) = src1 << BITS(src2, 4, 0));
+  INSTPAT("0000000 ????? ????? 010 ????? 01100 11", slt    , R, R(rd) = (sword_t)src1 < (sword_t)src2);
+  INSTPAT("0000000 ????? ????? 011 ????? 01100 11", sltu   , R, R(rd) = src1 < src2);
+  INSTPAT("0000000 ????? ????? 100 ????? 01100 11", xor    , R, R(rd) = src1 ^ src2);
+  INSTPAT("0000000 ????? ????? 101 ????? 01100 11", srl    , R, R(rd) = src1 >> BITS(src2, 4, 0));
+  INSTPAT("0100000 ????? ????? 101 ????? 01100 11", sra    , R, R(rd) = (sword_t)src1 >> BITS(src2, 4, 0));
+  INSTPAT("0000000 ????? ????? 110 ????? 01100 11", or     , R, R(rd) = src1 | src2);
+  INSTPAT("0000000 ????? ????? 111 ????? 01100 11", and    , R, R(rd) = src1 & src2);
+
+  INSTPAT("??????? ????? ????? 000 ????? 00011 11", fence  , N, );
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
 
   R(0) = 0; // reset $zero to 0
+  INSTPAT_BLOCK_NEXT(s);
 
   return 0;
 }
 
 int isa_exec_once(Decode *s) {
+#ifdef CONFIG_DECODE_CACHE
+  if (dcache_hit(s)) {
+    s->isa = s->dc->isa;
+    s->snpc = s->dc->snpc;
+    return decode_exec(s);
+  }
+#endif
   s->isa.inst.val = inst_fetch(&s->snpc, 4);
   return decode_exec(s);
 }
+
+#ifdef CONFIG_ENGINE_TCACHE
+int isa_exec_block(Decode *s, DecodeCache *dc, int n) {
+  s->dc = dc;
+  s->dc_end = dc + n;
+  s->pc = dc->pc;
+  s->snpc = dc->snpc;
+  s->isa = dc->isa;
+  decode_exec(s);
+  return s->dc - dc;
+}
+
+bool isa_inst_ends_block(Decode *s) {
+  // branches, jal, jalr, and the system instructions
+  uint32_t opcode = BITS(s->isa.inst.val, 6, 0);
+  return opcode == 0x63 || opcode == 0x67 || opcode == 0x6f || opcode == 0x73;
+}
+#endif
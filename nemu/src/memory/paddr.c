@@ -15,27 +15,292 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <device/mmio.h>
 #include <isa.h>
 
-#if   defined(CONFIG_PMEM_MALLOC)
-static uint8_t *pmem = NULL;
+#if   defined(CONFIG_PMEM_MALLOC) || defined(CONFIG_PMEM_MMAP)
+uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
-static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
+uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
 
-uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 
-static word_t pmem_read(paddr_t addr, int len) {
-  word_t ret = host_read(guest_to_host(addr), len);
-  return ret;
+#if defined(CONFIG_PMEM_MMAP) || defined(CONFIG_SNAPSHOT) || defined(MEM_REGION)
+#include <sys/mman.h>
+#include <signal.h>
+#endif
+
+#ifdef MEM_REGION
+/* Memory regions besides pmem. Accesses to pmem never search the table,
+ * since in_pmem() is always checked first. Each region is mapped without
+ * reserving swap space, so a large region only costs the pages touched.
+ */
+typedef struct {
+  const char *name;
+  paddr_t base;
+  uint64_t size;
+  bool rom;
+  uint8_t *host;
+} MemRegion;
+
+static MemRegion regions[] = {
+  IFDEF(CONFIG_MEM_ROM, { "rom", CONFIG_MEM_ROM_BASE, CONFIG_MEM_ROM_SIZE, true, NULL },)
+  IFDEF(CONFIG_MEM_HIGH, { "high", CONFIG_MEM_HIGH_BASE, CONFIG_MEM_HIGH_SIZE, false, NULL },)
+};
+
+static inline MemRegion* region_find(paddr_t addr) {
+  int i;
+  for (i = 0; i < ARRLEN(regions); i ++) {
+    if (addr - regions[i].base < regions[i].size) return &regions[i];
+  }
+  return NULL;
+}
+
+static bool region_overlap(paddr_t l1, uint64_t s1, paddr_t l2, uint64_t s2) {
+  return l1 < l2 + s2 && l2 < l1 + s1;
+}
+
+static void init_regions() {
+  int i, j;
+  for (i = 0; i < ARRLEN(regions); i ++) {
+    MemRegion *r = &regions[i];
+    Assert(r->base % PAGE_SIZE == 0 && r->size % PAGE_SIZE == 0,
+        "%s memory area is not page aligned", r->name);
+    Assert(!region_overlap(r->base, r->size, CONFIG_MBASE, CONFIG_MSIZE),
+        "%s memory area is overlapped with pmem", r->name);
+    for (j = 0; j < i; j ++) {
+      Assert(!region_overlap(r->base, r->size, regions[j].base, regions[j].size),
+          "%s memory area is overlapped with %s", r->name, regions[j].name);
+    }
+    r->host = mmap(NULL, r->size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    Assert(r->host != MAP_FAILED, "fail to mmap %s memory area", r->name);
+    Log("%s memory area [" FMT_PADDR ", " FMT_PADDR "]", r->name,
+        r->base, (paddr_t)(r->base + r->size - 1));
+  }
+}
+#endif
+
+uint8_t* paddr_to_host(paddr_t paddr, bool write) {
+  if (in_pmem(paddr)) return guest_to_host(paddr);
+#ifdef MEM_REGION
+  MemRegion *r = region_find(paddr);
+  if (r != NULL && !(write && r->rom)) return r->host + (paddr - r->base);
+#endif
+  return NULL;
+}
+
+#ifdef CONFIG_PMEM_MMAP_IMG
+static uint8_t *img_start = NULL, *img_end = NULL;
+
+// Map `size' bytes of the file `fd' copy-on-write at `addr'.
+void pmem_map_img(paddr_t addr, int fd, size_t size) {
+  Assert(addr % PAGE_SIZE == 0, "image address " FMT_PADDR " is not page aligned", addr);
+  Assert(in_pmem(addr) && in_pmem(addr + size - 1), "image is out of bound of pmem");
+  uint8_t *p = guest_to_host(addr);
+  size_t len = ROUNDUP(size, PAGE_SIZE);
+  void *ret = mmap(p, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+  Assert(ret == p, "fail to map the image");
+  img_start = p;
+  img_end = p + len;
+}
+#endif
+
+#if defined(CONFIG_PMEM_MMAP) && defined(CONFIG_MEM_RANDOM)
+#define LAZY_FILL
+#define FILL_SIZE (1ul << CONFIG_PMEM_FILL_SHIFT)
+#define NR_CHUNK ((CONFIG_MSIZE + FILL_SIZE - 1) / FILL_SIZE)
+
+/* pmem is mapped without access permission at first. The SIGSEGV handler
+ * makes a chunk accessible on its first touch, and fills it with random
+ * values generated from the index of the chunk, so that they are the
+ * same in every run no matter which chunk is touched first. The part
+ * of the chunk mapped to the image file is left untouched.
+ */
+static bool chunk_filled[NR_CHUNK] = {};
+static_assert(CONFIG_MSIZE % PAGE_SIZE == 0, "pmem is not page aligned");
+
+// the end of the chunk, since the last one may be shorter than FILL_SIZE
+static uint8_t* chunk_end(uint8_t *chunk) {
+  return (pmem + CONFIG_MSIZE - chunk < FILL_SIZE ? pmem + CONFIG_MSIZE : chunk + FILL_SIZE);
+}
+
+// Apply `fn' to the parts of the chunk which are not mapped to the image.
+static void chunk_apply(uint8_t *chunk, int (*fn)(void *, size_t, int), int arg) {
+  uint8_t *end = chunk_end(chunk);
+  uint8_t *l = end, *r = end; // [l, r) is mapped to the image
+#ifdef CONFIG_PMEM_MMAP_IMG
+  if (img_start < end && img_end > chunk) {
+    l = (img_start > chunk ? img_start : chunk);
+    r = (img_end < end ? img_end : end);
+  }
+#endif
+  if (l > chunk) { assert(fn(chunk, l - chunk, arg) == 0); }
+  if (end > r) { assert(fn(r, end - r, arg) == 0); }
+}
+
+static void pmem_fill(uint8_t *chunk) {
+  chunk_apply(chunk, mprotect, PROT_READ | PROT_WRITE);
+  uint64_t x = 0x9e3779b97f4a7c15ull * ((chunk - pmem) / FILL_SIZE + 1);
+  uint64_t *p;
+  for (p = (uint64_t *)chunk; p < (uint64_t *)chunk_end(chunk); p ++) {
+    // xorshift64
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+#ifdef CONFIG_PMEM_MMAP_IMG
+    if ((uint8_t *)p >= img_start && (uint8_t *)p < img_end) continue;
+#endif
+    *p = x;
+  }
+  chunk_filled[(chunk - pmem) / FILL_SIZE] = true;
+}
+#endif
+
+#ifdef CONFIG_SNAPSHOT
+#define NR_PAGE (CONFIG_MSIZE / PAGE_SIZE)
+
+/* When a snapshot is taken, pmem is write-protected. The first write
+ * to a page after that is caught by the SIGSEGV handler, which saves
+ * the content of the page and makes it writable. Restoring a snapshot
+ * only copies back the pages written since then, so both taking and
+ * restoring are O(dirty pages).
+ */
+static bool snap_valid = false;
+static uint8_t *snap_data = NULL; // saved content of page i at snap_data + i * PAGE_SIZE
+static bool page_saved[NR_PAGE] = {};
+static bool page_dirty[NR_PAGE] = {};
+static uint32_t dirty_list[NR_PAGE];
+static int nr_dirty = 0;
+#ifdef LAZY_FILL
+// chunks filled after the snapshot are dropped on restoring, and will
+// be filled with the same values again when they are touched
+static bool snap_chunk_filled[NR_CHUNK] = {};
+#endif
+
+static bool page_protected(size_t idx) {
+  if (!snap_valid || page_dirty[idx]) return false;
+#ifdef LAZY_FILL
+  if (!snap_chunk_filled[idx * PAGE_SIZE / FILL_SIZE]) {
+    // only the image is accessible in a chunk which is not filled yet
+#ifdef CONFIG_PMEM_MMAP_IMG
+    uint8_t *page = pmem + idx * PAGE_SIZE;
+    return page >= img_start && page < img_end;
+#else
+    return false;
+#endif
+  }
+#endif
+  return true;
+}
+
+static void snapshot_page_fault(size_t idx) {
+  uint8_t *page = pmem + idx * PAGE_SIZE;
+  if (!page_saved[idx]) {
+    memcpy(snap_data + idx * PAGE_SIZE, page, PAGE_SIZE);
+    page_saved[idx] = true;
+  }
+  page_dirty[idx] = true;
+  dirty_list[nr_dirty ++] = idx;
+  assert(mprotect(page, PAGE_SIZE, PROT_READ | PROT_WRITE) == 0);
+}
+
+void pmem_snapshot_save() {
+  if (snap_data == NULL) {
+    snap_data = mmap(NULL, CONFIG_MSIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    Assert(snap_data != MAP_FAILED, "fail to mmap the memory for snapshots");
+  } else {
+    // drop the pages saved for the previous snapshot
+    madvise(snap_data, CONFIG_MSIZE, MADV_DONTNEED);
+  }
+  memset(page_saved, 0, sizeof(page_saved));
+  memset(page_dirty, 0, sizeof(page_dirty));
+  nr_dirty = 0;
+#ifdef LAZY_FILL
+  memcpy(snap_chunk_filled, chunk_filled, sizeof(chunk_filled));
+  int i;
+  for (i = 0; i < NR_CHUNK; i ++) {
+    uint8_t *chunk = pmem + i * FILL_SIZE;
+    if (chunk_filled[i]) { assert(mprotect(chunk, chunk_end(chunk) - chunk, PROT_READ) == 0); }
+  }
+#ifdef CONFIG_PMEM_MMAP_IMG
+  if (img_start != NULL) { assert(mprotect(img_start, img_end - img_start, PROT_READ) == 0); }
+#endif
+#else
+  assert(mprotect(pmem, CONFIG_MSIZE, PROT_READ) == 0);
+#endif
+  snap_valid = true;
+}
+
+void pmem_snapshot_restore() {
+  assert(snap_valid);
+  int i;
+  for (i = 0; i < nr_dirty; i ++) {
+    uint8_t *page = pmem + dirty_list[i] * PAGE_SIZE;
+    memcpy(page, snap_data + dirty_list[i] * PAGE_SIZE, PAGE_SIZE);
+    assert(mprotect(page, PAGE_SIZE, PROT_READ) == 0);
+    page_dirty[dirty_list[i]] = false;
+  }
+  nr_dirty = 0;
+#ifdef LAZY_FILL
+  for (i = 0; i < NR_CHUNK; i ++) {
+    if (chunk_filled[i] && !snap_chunk_filled[i]) {
+      uint8_t *chunk = pmem + i * FILL_SIZE;
+      chunk_apply(chunk, mprotect, PROT_NONE);
+      chunk_apply(chunk, madvise, MADV_DONTNEED);
+      chunk_filled[i] = false;
+    }
+  }
+#endif
+}
+#endif
+
+#if defined(LAZY_FILL) || defined(CONFIG_SNAPSHOT)
+static void pmem_fault_handler(int sig, siginfo_t *info, void *ucontext) {
+  uint8_t *addr = info->si_addr;
+  if (addr >= pmem && addr < pmem + CONFIG_MSIZE) {
+#ifdef CONFIG_SNAPSHOT
+    size_t idx = (addr - pmem) / PAGE_SIZE;
+    if (page_protected(idx)) { snapshot_page_fault(idx); return; }
+#endif
+#ifdef LAZY_FILL
+    size_t c = (addr - pmem) / FILL_SIZE;
+    if (!chunk_filled[c]) { pmem_fill(pmem + c * FILL_SIZE); return; }
+#endif
+  }
+  // not caused by pmem, crash with the default action when returned
+  signal(SIGSEGV, SIG_DFL);
 }
 
-static void pmem_write(paddr_t addr, int len, word_t data) {
-  host_write(guest_to_host(addr), len, data);
+static void init_fault_handler() {
+  struct sigaction s = {};
+  s.sa_sigaction = pmem_fault_handler;
+  s.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&s.sa_mask);
+  assert(sigaction(SIGSEGV, &s, NULL) == 0);
 }
 
+// Touch the pages for writing before the kernel writes to them, e.g. by
+// read(2), which fails with EFAULT instead of raising SIGSEGV.
+void pmem_fault_in(paddr_t addr, size_t len) {
+  if (!in_pmem(addr)) return;
+  uint8_t *p;
+  for (p = guest_to_host(ROUNDDOWN(addr, PAGE_SIZE)); p < guest_to_host(addr) + len; p += PAGE_SIZE) {
+    *(volatile uint8_t *)p = *(volatile uint8_t *)p;
+  }
+}
+#endif
+
+#ifdef CONFIG_PMEM_MMAP
+static void init_pmem_mmap() {
+  int prot = MUXDEF(CONFIG_MEM_RANDOM, PROT_NONE, PROT_READ | PROT_WRITE);
+  pmem = mmap(NULL, CONFIG_MSIZE, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(pmem != MAP_FAILED, "fail to mmap pmem");
+  madvise(pmem, CONFIG_MSIZE, MADV_HUGEPAGE);
+}
+#endif
+
 static void out_of_bound(paddr_t addr) {
   panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
@@ -45,20 +310,40 @@ void init_mem() {
 #if   defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
+#elif defined(CONFIG_PMEM_MMAP)
+  init_pmem_mmap();
 #endif
+#ifndef CONFIG_PMEM_MMAP
   IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
+#endif
+#if defined(LAZY_FILL) || defined(CONFIG_SNAPSHOT)
+  init_fault_handler();
+#endif
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
+#ifdef MEM_REGION
+  init_regions();
+#endif
 }
 
-word_t paddr_read(paddr_t addr, int len) {
-  if (likely(in_pmem(addr))) return pmem_read(addr, len);
+word_t paddr_read_slow(paddr_t addr, int len) {
+#ifdef MEM_REGION
+  MemRegion *r = region_find(addr);
+  if (r != NULL) return host_read(r->host + (addr - r->base), len);
+#endif
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
   out_of_bound(addr);
   return 0;
 }
 
-void paddr_write(paddr_t addr, int len, word_t data) {
-  if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
+void paddr_write_slow(paddr_t addr, int len, word_t data) {
+#ifdef MEM_REGION
+  MemRegion *r = region_find(addr);
+  if (r != NULL && !r->rom) {
+    host_write(r->host + (addr - r->base), len, data);
+    pmem_invalidate(addr, len);
+    return;
+  }
+#endif
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
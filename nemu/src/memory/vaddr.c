@@ -14,16 +14,121 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <device/mmio.h>
 
-word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+/* A direct-mapped software TLB, with separate entries for instruction
+ * fetching, reading and writing. An entry maps a guest virtual page to
+ * the host address of the guest physical page in pmem. Reading entries
+ * may also map pages of plain memory MMIO regions (e.g. the frame buffer).
+ * Misses, cross-page accesses and other MMIO go through isa_mmu_translate()
+ * and paddr_*().
+ */
+#define TLB_NR_ENTRY 256
+
+typedef struct {
+  vaddr_t vpn;
+  paddr_t ppn;
+  uint8_t *host; // NULL if the entry is invalid
+} TLBEntry;
+
+static TLBEntry tlb[3][TLB_NR_ENTRY] = {}; // indexed by MEM_TYPE_*
+
+IFetchCache ifetch_cache = { .tag = PAGE_MASK };
+
+// Should be called when the address space is changed,
+// e.g. on writes to satp and on sfence.vma.
+void tlb_flush() {
+  memset(tlb, 0, sizeof(tlb));
+  ifetch_cache.tag = PAGE_MASK;
+}
+
+static inline TLBEntry* tlb_entry(vaddr_t addr, int type) {
+  return &tlb[type][(addr >> PAGE_SHIFT) % TLB_NR_ENTRY];
+}
+
+static inline bool tlb_hit(TLBEntry *e, vaddr_t addr, int len) {
+  return e->host != NULL && e->vpn == (addr >> PAGE_SHIFT) &&
+    (addr & PAGE_MASK) + len <= PAGE_SIZE;
+}
+
+static paddr_t tlb_fill(vaddr_t addr, int len, int type) {
+  paddr_t ret = isa_mmu_translate(addr, len, type);
+  Assert((ret & PAGE_MASK) == MEM_RET_OK, "fail to translate vaddr = " FMT_WORD
+      " at pc = " FMT_WORD, addr, cpu.pc);
+  paddr_t paddr = (ret & ~PAGE_MASK) | (addr & PAGE_MASK);
+  uint8_t *host = paddr_to_host(paddr & ~PAGE_MASK, type == MEM_TYPE_WRITE);
+#if defined(CONFIG_DEVICE) && !defined(CONFIG_DIFFTEST)
+  // writes are not mapped, since they should set the dirty flag of the region;
+  // not available with difftest, since device accesses should be skipped by REF
+  if (host == NULL && type == MEM_TYPE_READ) { host = mmio_ram_page(paddr); }
+#endif
+  if (host != NULL) {
+    TLBEntry *e = tlb_entry(addr, type);
+    e->vpn = addr >> PAGE_SHIFT;
+    e->ppn = paddr >> PAGE_SHIFT;
+    e->host = host;
+  }
+  return paddr;
+}
+
+static word_t vaddr_read_slow(vaddr_t addr, int len, int type) {
+  if ((addr & PAGE_MASK) + len > PAGE_SIZE) {
+    word_t data = 0;
+    int i;
+    for (i = 0; i < len; i ++) {
+      data |= vaddr_read_slow(addr + i, 1, type) << (i * 8);
+    }
+    return data;
+  }
+  return paddr_read(tlb_fill(addr, len, type), len);
+}
+
+word_t vaddr_read_tlb(vaddr_t addr, int len, int type) {
+  TLBEntry *e = tlb_entry(addr, type);
+  if (likely(tlb_hit(e, addr, len))) return host_read(e->host + (addr & PAGE_MASK), len);
+  return vaddr_read_slow(addr, len, type);
+}
+
+static void vaddr_write_slow(vaddr_t addr, int len, word_t data) {
+  if ((addr & PAGE_MASK) + len > PAGE_SIZE) {
+    int i;
+    for (i = 0; i < len; i ++) {
+      vaddr_write_slow(addr + i, 1, data >> (i * 8));
+    }
+    return;
+  }
+  paddr_write(tlb_fill(addr, len, MEM_TYPE_WRITE), len, data);
 }
 
-word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+// Fetch the instruction, and remember the page for the following fetches
+// if it is plain memory.
+word_t vaddr_ifetch_slow(vaddr_t addr, int len) {
+  uint8_t *host = NULL;
+  word_t ret;
+  if (isa_mmu_check(addr, len, MEM_TYPE_IFETCH) == MMU_DIRECT) {
+    host = paddr_to_host(addr & ~PAGE_MASK, false);
+    ret = paddr_read(addr, len);
+  } else {
+    ret = vaddr_read_tlb(addr, len, MEM_TYPE_IFETCH);
+    TLBEntry *e = tlb_entry(addr, MEM_TYPE_IFETCH);
+    if (e->host != NULL && e->vpn == (addr >> PAGE_SHIFT)) { host = e->host; }
+  }
+  if (host != NULL) {
+    ifetch_cache.tag = addr & ~PAGE_MASK;
+    ifetch_cache.host = host;
+  }
+  return ret;
 }
 
-void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+void vaddr_write_tlb(vaddr_t addr, int len, word_t data) {
+  TLBEntry *e = tlb_entry(addr, MEM_TYPE_WRITE);
+  if (likely(tlb_hit(e, addr, len))) {
+    host_write(e->host + (addr & PAGE_MASK), len, data);
+    pmem_invalidate((e->ppn << PAGE_SHIFT) | (addr & PAGE_MASK), len);
+    return;
+  }
+  vaddr_write_slow(addr, len, data);
 }
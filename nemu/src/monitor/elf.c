@@ -0,0 +1,192 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+
+#ifndef CONFIG_TARGET_AM
+#include <elf.h>
+
+#ifdef CONFIG_ISA64
+#define ELF_CLASS ELFCLASS64
+#define ELF_ST_TYPE ELF64_ST_TYPE
+typedef Elf64_Ehdr Elf_Ehdr;
+typedef Elf64_Phdr Elf_Phdr;
+typedef Elf64_Shdr Elf_Shdr;
+typedef Elf64_Sym  Elf_Sym;
+#else
+#define ELF_CLASS ELFCLASS32
+#define ELF_ST_TYPE ELF32_ST_TYPE
+typedef Elf32_Ehdr Elf_Ehdr;
+typedef Elf32_Phdr Elf_Phdr;
+typedef Elf32_Shdr Elf_Shdr;
+typedef Elf32_Sym  Elf_Sym;
+#endif
+
+#ifndef EM_LOONGARCH
+#define EM_LOONGARCH 258
+#endif
+
+#define ELF_MACHINE MUXDEF(CONFIG_ISA_x86, EM_386, MUXDEF(CONFIG_ISA_mips32, EM_MIPS, \
+  MUXDEF(CONFIG_ISA_riscv, EM_RISCV, EM_LOONGARCH)))
+
+typedef struct {
+  vaddr_t addr;
+  word_t size;
+  const char *name;
+} Symbol;
+
+// function symbols sorted by address
+static Symbol *symtab = NULL;
+static int nr_sym = 0;
+static char *strtab = NULL;
+
+// Read [offset, offset + size) of the file, which should be inside the file.
+static void read_at(FILE *fp, uint64_t offset, void *buf, uint64_t size) {
+  fseek(fp, 0, SEEK_END);
+  uint64_t file_size = ftell(fp);
+  Assert(offset <= file_size && size <= file_size - offset,
+      "[%#" PRIx64 ", %#" PRIx64 ") is out of bound of the ELF file",
+      offset, offset + size);
+  if (size == 0) return;
+  fseek(fp, offset, SEEK_SET);
+  int ret = fread(buf, size, 1, fp);
+  Assert(ret == 1, "fail to read the ELF file at offset %#" PRIx64, offset);
+}
+
+bool is_elf(FILE *fp) {
+  uint8_t ident[SELFMAG];
+  fseek(fp, 0, SEEK_SET);
+  return fread(ident, SELFMAG, 1, fp) == 1 && memcmp(ident, ELFMAG, SELFMAG) == 0;
+}
+
+static int symbol_cmp(const void *a, const void *b) {
+  vaddr_t x = ((const Symbol *)a)->addr, y = ((const Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+static void load_symtab(FILE *fp, Elf_Ehdr *eh) {
+  // drop the symbols of the previously loaded ELF file
+  free(symtab);
+  free(strtab);
+  symtab = NULL;
+  strtab = NULL;
+  nr_sym = 0;
+
+  if (eh->e_shnum == 0) {
+    Log("No section header is found in the ELF file");
+    return;
+  }
+  Assert(eh->e_shentsize == sizeof(Elf_Shdr), "unexpected size of section header %d", eh->e_shentsize);
+  Elf_Shdr *sh = malloc(sizeof(Elf_Shdr) * eh->e_shnum);
+  assert(sh);
+  read_at(fp, eh->e_shoff, sh, (uint64_t)sizeof(Elf_Shdr) * eh->e_shnum);
+
+  int i;
+  for (i = 0; i < eh->e_shnum && sh[i].sh_type != SHT_SYMTAB; i ++);
+  if (i == eh->e_shnum) {
+    Log("No symbol table is found in the ELF file");
+    free(sh);
+    return;
+  }
+
+  Assert(sh[i].sh_link < eh->e_shnum, "invalid string table index %d", sh[i].sh_link);
+  Elf_Shdr *str = &sh[sh[i].sh_link];
+  // terminate the last string even if the file does not
+  strtab = malloc(str->sh_size + 1);
+  assert(strtab);
+  read_at(fp, str->sh_offset, strtab, str->sh_size);
+  strtab[str->sh_size] = '\0';
+
+  int nr = sh[i].sh_size / sizeof(Elf_Sym);
+  Elf_Sym *sym = malloc(sizeof(Elf_Sym) * nr);
+  assert(sym);
+  read_at(fp, sh[i].sh_offset, sym, sizeof(Elf_Sym) * nr);
+
+  symtab = malloc(sizeof(Symbol) * nr);
+  assert(symtab);
+  int j;
+  for (j = 0; j < nr; j ++) {
+    if (ELF_ST_TYPE(sym[j].st_info) != STT_FUNC || sym[j].st_name >= str->sh_size) continue;
+    symtab[nr_sym ++] = (Symbol) { .addr = sym[j].st_value, .size = sym[j].st_size,
+      .name = strtab + sym[j].st_name };
+  }
+  qsort(symtab, nr_sym, sizeof(Symbol), symbol_cmp);
+  Log("Load %d function symbols from the ELF file", nr_sym);
+
+  free(sym);
+  free(sh);
+}
+
+// Load the PT_LOAD segments of the ELF file and set pc to the entry.
+// Return the size of memory from the reset vector to the end of the
+// segments, which is used by difftest.
+long load_elf(FILE *fp) {
+  Elf_Ehdr eh;
+  read_at(fp, 0, &eh, sizeof(eh));
+  Assert(eh.e_ident[EI_CLASS] == ELF_CLASS, "the class of the ELF file does not match the ISA");
+  Assert(eh.e_machine == ELF_MACHINE, "the machine %d of the ELF file does not match the ISA %s",
+      eh.e_machine, str(__GUEST_ISA__));
+  Assert(eh.e_phnum == 0 || eh.e_phentsize == sizeof(Elf_Phdr),
+      "unexpected size of program header %d", eh.e_phentsize);
+
+  paddr_t end = RESET_VECTOR;
+  int i;
+  for (i = 0; i < eh.e_phnum; i ++) {
+    Elf_Phdr ph;
+    read_at(fp, eh.e_phoff + (uint64_t)i * eh.e_phentsize, &ph, sizeof(ph));
+    if (ph.p_type != PT_LOAD || ph.p_memsz == 0) continue;
+    // the segment should be in a single memory area, which is contiguous in the host
+    uint8_t *host = paddr_to_host(ph.p_paddr, false);
+    Assert(host != NULL && paddr_to_host(ph.p_paddr + ph.p_memsz - 1, false) == host + ph.p_memsz - 1,
+        "segment [" FMT_PADDR ", " FMT_PADDR ") is out of bound of memory",
+        (paddr_t)ph.p_paddr, (paddr_t)(ph.p_paddr + ph.p_memsz));
+    Log("Load segment [" FMT_PADDR ", " FMT_PADDR ")",
+        (paddr_t)ph.p_paddr, (paddr_t)(ph.p_paddr + ph.p_memsz));
+
+    pmem_fault_in(ph.p_paddr, ph.p_memsz);
+    if (ph.p_filesz > 0) {
+      read_at(fp, ph.p_offset, host, ph.p_filesz);
+    }
+    // .bss
+    memset(host + ph.p_filesz, 0, ph.p_memsz - ph.p_filesz);
+    if (in_pmem(ph.p_paddr) && ph.p_paddr + ph.p_memsz > end) { end = ph.p_paddr + ph.p_memsz; }
+  }
+
+  load_symtab(fp, &eh);
+
+  cpu.pc = eh.e_entry;
+  Log("The entry of the ELF file is " FMT_WORD, cpu.pc);
+  return end - RESET_VECTOR;
+}
+
+// Return the name of the function containing `pc', or NULL if not found.
+// The offset of `pc' from the beginning of the function is stored into
+// `offset' if it is not NULL.
+const char* symbol_lookup(vaddr_t pc, word_t *offset) {
+  int l = 0, r = nr_sym;
+  // find the last symbol with addr <= pc
+  while (l < r) {
+    int mid = (l + r) / 2;
+    if (symtab[mid].addr <= pc) l = mid + 1;
+    else r = mid;
+  }
+  if (l == 0) return NULL;
+  Symbol *s = &symtab[l - 1];
+  if (pc - s->addr >= s->size && s->size != 0) return NULL;
+  if (offset != NULL) *offset = pc - s->addr;
+  return s->name;
+}
+#endif
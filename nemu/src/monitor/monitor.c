@@ -19,10 +19,11 @@
 void init_rand();
 void init_log(const char *log_file);
 void init_mem();
-void init_difftest(char *ref_so_file, long img_size, int port);
+void init_difftest(char *ref_so_file, char *img_file, long img_size, int port);
 void init_device();
 void init_sdb();
 void init_disasm(const char *triple);
+void init_jit();
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
@@ -39,11 +40,15 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void server_set_path(char *path);
+bool is_elf(FILE *fp);
+long load_elf(FILE *fp);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static int difftest_port = 1234;
+static bool img_is_elf = false;
 
 static long load_img() {
   if (img_file == NULL) {
@@ -54,42 +59,66 @@ static long load_img() {
   FILE *fp = fopen(img_file, "rb");
   Assert(fp, "Can not open '%s'", img_file);
 
+  if (is_elf(fp)) {
+    Log("The image is %s, which is an ELF file", img_file);
+    img_is_elf = true;
+    long size = load_elf(fp);
+    fclose(fp);
+    return size;
+  }
+
   fseek(fp, 0, SEEK_END);
   long size = ftell(fp);
 
   Log("The image is %s, size = %ld", img_file, size);
 
+#ifdef CONFIG_PMEM_MMAP_IMG
+  pmem_map_img(RESET_VECTOR, fileno(fp), size);
+#else
   fseek(fp, 0, SEEK_SET);
+  pmem_fault_in(RESET_VECTOR, size);
   int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
   assert(ret == 1);
+#endif
 
   fclose(fp);
   return size;
 }
 
+// Used by the fork server to load the requested image in the child.
+long load_img_file(char *file) {
+  img_file = file;
+  img_is_elf = false;
+  return load_img();
+}
+
 static int parse_args(int argc, char *argv[]) {
   const struct option table[] = {
     {"batch"    , no_argument      , NULL, 'b'},
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"server"   , required_argument, NULL, 's'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:s:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 's': server_set_path(optarg); break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
+        printf("\tIMAGE can be a raw binary or an ELF file\n\n");
         printf("\t-b,--batch              run with batch mode\n");
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-s,--server=SOCKET      run as a fork server listening on SOCKET\n");
         printf("\n");
         exit(0);
     }
@@ -118,11 +147,14 @@ void init_monitor(int argc, char *argv[]) {
   /* Perform ISA dependent initialization. */
   init_isa();
 
+  /* Initialize the code cache of the JIT engine. */
+  IFDEF(CONFIG_ENGINE_JIT, init_jit());
+
   /* Load the image to memory. This will overwrite the built-in image. */
   long img_size = load_img();
 
   /* Initialize differential testing. */
-  init_difftest(diff_so_file, img_size, difftest_port);
+  init_difftest(diff_so_file, img_is_elf ? NULL : img_file, img_size, difftest_port);
 
   /* Initialize the simple debugger. */
   init_sdb();
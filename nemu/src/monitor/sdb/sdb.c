@@ -98,7 +98,7 @@ static int cmd_x(char *args) {
     // 执行内存读取和打印
     for (; l > 0; l--) {
         uint32_t value = paddr_read(offset, 4);
-        printf("%x: %08x\n", offset, value);
+        printf(FMT_PADDR ": %08x\n", offset, value);
         offset += 4;
     }
     return 0;
@@ -109,8 +109,12 @@ static int cmd_info(char* args){
       isa_reg_display();
       return 0;
     }
+    if (strcmp(args,"i")==0){
+      MUXDEF(CONFIG_ITRACE, itrace_dump(), printf("itrace is not enabled\n"));
+      return 0;
+    }
   }else{
-    printf("usage info [r]");
+    printf("usage info [r|i]");
     return 0;
   }
   return 0;
@@ -124,6 +128,18 @@ static int cmd_w(char * args){
   new_wp(args);
   return 0;
 }
+#ifdef CONFIG_SNAPSHOT
+static int cmd_snapshot(char *args) {
+  snapshot_save();
+  return 0;
+}
+
+static int cmd_restore(char *args) {
+  if (!snapshot_restore()) printf("No snapshot is taken\n");
+  return 0;
+}
+#endif
+
 static int cmd_help(char *args);
 
 static struct {
@@ -135,10 +151,14 @@ static struct {
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
   { "si","program excutes n steps", cmd_si},
-  {"info","r to show regs,w to show monitor",cmd_info},
+  {"info","r to show regs,w to show monitor,i to show recent instructions",cmd_info},
   {"x","usage x [N] [EXPR]",cmd_x},
   {"p","p EXPR",cmd_p},
   {"w","w EXPR",cmd_w},
+#ifdef CONFIG_SNAPSHOT
+  { "snapshot", "Save the state of the machine", cmd_snapshot },
+  { "restore", "Go back to the state saved by the last snapshot", cmd_restore },
+#endif
   /* TODO: Add more commands */
 };
 
@@ -27,5 +27,6 @@ typedef struct watchpoint {
 } WP;
 word_t expr(char *e, bool *success);
 void step_watchpoint();
+bool wp_active();
 WP* new_wp(char * watch_expr);
 #endif
@@ -59,6 +59,10 @@ void free_wp(WP *wp){
     wp->next = free_;
     free_ = wp;
 }
+//是否有使用中的watchpoint
+bool wp_active(){
+    return head != NULL;
+}
 void step_watchpoint(){
     struct watchpoint* temp=head;
     while (temp!=NULL){
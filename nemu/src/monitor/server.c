@@ -0,0 +1,115 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <memory/paddr.h>
+
+#ifndef CONFIG_TARGET_AM
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+long load_img_file(char *file);
+int is_exit_status_bad();
+void log_flush();
+
+static char *server_path = NULL;
+
+void server_set_path(char *path) {
+  server_path = path;
+}
+
+bool server_mode() {
+  return server_path != NULL;
+}
+
+/* The fork server is initialized once and forks a child for each
+ * connection. A request is a line with the path of the image to run,
+ * or an empty line to run the image loaded at startup. The child runs
+ * the image in batch mode, replies a line of results and exits.
+ */
+static bool read_line(int fd, char *buf, int size) {
+  int n = 0;
+  while (n < size - 1) {
+    char c;
+    if (read(fd, &c, 1) != 1) break;
+    if (c == '\n') { buf[n] = '\0'; return true; }
+    buf[n ++] = c;
+  }
+  buf[n] = '\0';
+  return n > 0;
+}
+
+static void serve(int conn, char *req) {
+  extern uint64_t g_nr_guest_inst;
+  if (req[0] != '\0') {
+    // only an ELF file sets the entry, so do not keep the one of the startup image
+    cpu.pc = RESET_VECTOR;
+    long size = load_img_file(req);
+    difftest_reload(size);
+  }
+
+  uint64_t start = get_time();
+  cpu_exec(-1);
+  uint64_t time = get_time() - start;
+
+  int bad = is_exit_status_bad();
+  dprintf(conn, "state = %d, halt_pc = " FMT_WORD ", halt_ret = %d, "
+      "inst = %" PRIu64 ", time = %" PRIu64 " us, exit = %d\n",
+      nemu_state.state, nemu_state.halt_pc, nemu_state.halt_ret,
+      g_nr_guest_inst, time, bad);
+  close(conn);
+  exit(bad);
+}
+
+void server_mainloop() {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(fd >= 0);
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  Assert(strlen(server_path) < sizeof(addr.sun_path), "socket path '%s' is too long", server_path);
+  strcpy(addr.sun_path, server_path);
+  unlink(server_path);
+  Assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, "Can not bind '%s'", server_path);
+  Assert(listen(fd, 64) == 0, "Can not listen on '%s'", server_path);
+  // children are reaped automatically
+  signal(SIGCHLD, SIG_IGN);
+  Log("Fork server is listening on %s", server_path);
+
+  while (true) {
+    int conn = accept(fd, NULL, NULL);
+    if (conn < 0) {
+      Assert(errno == EINTR, "accept() fails with errno = %d", errno);
+      continue;
+    }
+    char req[4096];
+    if (!read_line(conn, req, sizeof(req))) { close(conn); continue; }
+
+    // do not let the children write the buffered output again
+    fflush(stdout);
+    log_flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fd);
+      serve(conn, req);
+    }
+    if (pid < 0) { Log("fork() fails with errno = %d", errno); }
+    close(conn);
+  }
+}
+#endif
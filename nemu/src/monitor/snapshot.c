@@ -0,0 +1,103 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <cpu/tcache.h>
+#include <cpu/jit.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+#ifdef CONFIG_SNAPSHOT
+#define MAX_REGION 64
+
+// state of devices which is saved by copying
+typedef struct {
+  void *ptr;
+  size_t size;
+  void *saved;
+} Region;
+
+static Region region[MAX_REGION] = {};
+static int nr_region = 0;
+
+// called after restoring, for the state derived from the regions
+#define MAX_RESTORE_HOOK 8
+static void (*restore_hook[MAX_RESTORE_HOOK])() = {};
+static int nr_restore_hook = 0;
+
+static struct {
+  bool valid;
+  CPU_state cpu;
+  NEMUState state;
+  uint64_t nr_guest_inst;
+} snap = {};
+
+void snapshot_register(void *ptr, size_t size) {
+  Assert(nr_region < MAX_REGION, "too many regions for snapshots");
+  region[nr_region ++] = (Region) { .ptr = ptr, .size = size, .saved = NULL };
+}
+
+void snapshot_register_restore(void (*hook)()) {
+  Assert(nr_restore_hook < MAX_RESTORE_HOOK, "too many restore hooks for snapshots");
+  restore_hook[nr_restore_hook ++] = hook;
+}
+
+void snapshot_save() {
+  extern uint64_t g_nr_guest_inst;
+  snap.cpu = cpu;
+  snap.state = nemu_state;
+  snap.nr_guest_inst = g_nr_guest_inst;
+  int i;
+  for (i = 0; i < nr_region; i ++) {
+    Region *r = &region[i];
+    if (r->saved == NULL) {
+      r->saved = malloc(r->size);
+      assert(r->saved);
+    }
+    memcpy(r->saved, r->ptr, r->size);
+  }
+  pmem_snapshot_save();
+  snap.valid = true;
+  Log("Snapshot is taken at pc = " FMT_WORD, cpu.pc);
+}
+
+bool snapshot_restore() {
+  extern uint64_t g_nr_guest_inst;
+  if (!snap.valid) return false;
+  cpu = snap.cpu;
+  nemu_state = snap.state;
+  g_nr_guest_inst = snap.nr_guest_inst;
+  int i;
+  for (i = 0; i < nr_region; i ++) {
+    memcpy(region[i].ptr, region[i].saved, region[i].size);
+  }
+  pmem_snapshot_restore();
+
+  // pmem is changed without paddr_write(), drop all cached code
+#ifdef DCACHE_GLOBAL
+  dcache_flush();
+#endif
+  IFDEF(CONFIG_ENGINE_TCACHE, tcache_flush());
+  IFDEF(CONFIG_ENGINE_JIT, jit_stale = true);
+  tlb_flush();
+  for (i = 0; i < nr_restore_hook; i ++) {
+    restore_hook[i]();
+  }
+  Log("Snapshot is restored at pc = " FMT_WORD, cpu.pc);
+  return true;
+}
+#endif
@@ -22,6 +22,7 @@
 #include "llvm/MC/MCContext.h"
 #include "llvm/MC/MCDisassembler/MCDisassembler.h"
 #include "llvm/MC/MCInstPrinter.h"
+#include "llvm/MC/MCInstrInfo.h"
 #if LLVM_VERSION_MAJOR >= 14
 #include "llvm/MC/TargetRegistry.h"
 #if LLVM_VERSION_MAJOR >= 15
@@ -45,6 +46,7 @@ using namespace llvm;
 static llvm::MCDisassembler *gDisassembler = nullptr;
 static llvm::MCSubtargetInfo *gSTI = nullptr;
 static llvm::MCInstPrinter *gIP = nullptr;
+static llvm::MCInstrInfo *gMII = nullptr;
 
 extern "C" void init_disasm(const char *triple) {
   llvm::InitializeAllTargetInfos();
@@ -55,7 +57,6 @@ extern "C" void init_disasm(const char *triple) {
   std::string errstr;
   std::string gTriple(triple);
 
-  llvm::MCInstrInfo *gMII = nullptr;
   llvm::MCRegisterInfo *gMRI = nullptr;
   auto target = llvm::TargetRegistry::lookupTarget(gTriple, errstr);
   if (!target) {
@@ -92,11 +93,43 @@ extern "C" void init_disasm(const char *triple) {
     gIP->applyTargetSpecificCLOption("no-aliases");
 }
 
-extern "C" void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+// The text of an instruction only depends on its encoding, unless it has
+// a pc-relative operand, which is printed as an address. The first kind is
+// cached with (code, nbyte) as the key, the second kind with (pc, code).
+// An entry whose `pcrel` is set only tells that the encoding is pc-relative.
+#define DISASM_CACHE_SIZE 4096
+#define DISASM_TEXT_LEN 64
+
+struct DisasmEntry {
+  bool valid, pcrel;
+  uint8_t nbyte;
+  uint64_t code, pc;
+  char text[DISASM_TEXT_LEN];
+};
+
+static DisasmEntry gCache[DISASM_CACHE_SIZE] = {};
+static uint64_t gCacheHit = 0, gCacheMiss = 0;
+
+static DisasmEntry* cache_slot(uint64_t code, int nbyte, uint64_t pc) {
+  uint64_t h = (code ^ (pc * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull + nbyte;
+  return &gCache[(h >> 40) % DISASM_CACHE_SIZE];
+}
+
+static bool is_pcrel(const MCInst &inst) {
+  const MCInstrDesc &desc = gMII->get(inst.getOpcode());
+  if (desc.isBranch() || desc.isCall()) return true;
+  for (const MCOperandInfo &op : desc.operands()) {
+    if (op.OperandType == MCOI::OPERAND_PCREL) return true;
+  }
+  return false;
+}
+
+static void disassemble_inst(char *str, int size, uint64_t pc, uint8_t *code, int nbyte, bool *pcrel) {
   MCInst inst;
   llvm::ArrayRef<uint8_t> arr(code, nbyte);
   uint64_t dummy_size = 0;
   gDisassembler->getInstruction(inst, dummy_size, arr, pc, llvm::nulls());
+  *pcrel = is_pcrel(inst);
 
   std::string s;
   raw_string_ostream os(s);
@@ -107,3 +140,44 @@ extern "C" void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int
   assert((int)s.length() - skip < size);
   strcpy(str, p);
 }
+
+extern "C" void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+  if (nbyte > 8) {
+    bool pcrel;
+    disassemble_inst(str, size, pc, code, nbyte, &pcrel);
+    return;
+  }
+
+  uint64_t key = 0;
+  memcpy(&key, code, nbyte);
+  DisasmEntry *e = cache_slot(key, nbyte, 0);
+  bool known = e->valid && e->code == key && e->nbyte == nbyte;
+  if (known && e->pcrel) {
+    e = cache_slot(key, nbyte, pc);
+    known = e->valid && e->code == key && e->nbyte == nbyte && e->pcrel && e->pc == pc;
+  }
+  if (known) {
+    gCacheHit ++;
+    assert((int)strlen(e->text) < size);
+    strcpy(str, e->text);
+    return;
+  }
+
+  gCacheMiss ++;
+  bool pcrel;
+  disassemble_inst(str, size, pc, code, nbyte, &pcrel);
+  if (strlen(str) >= DISASM_TEXT_LEN) return;
+  e = cache_slot(key, nbyte, 0);
+  if (pcrel) {
+    // remember that the encoding is pc-relative
+    *e = DisasmEntry { true, true, (uint8_t)nbyte, key, 0, "" };
+    e = cache_slot(key, nbyte, pc);
+  }
+  *e = DisasmEntry { true, pcrel, (uint8_t)nbyte, key, pc, "" };
+  strcpy(e->text, str);
+}
+
+extern "C" void disasm_cache_stat(uint64_t *hit, uint64_t *miss) {
+  *hit = gCacheHit;
+  *miss = gCacheMiss;
+}
@@ -18,3 +18,7 @@ CXXSRC = src/utils/disasm.cc
 CXXFLAGS += $(shell llvm-config --cxxflags) -fPIE
 LIBS += $(shell llvm-config --libs)
 endif
+
+ifndef CONFIG_TARGET_AM
+LIBS += -lpthread
+endif
@@ -0,0 +1,86 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifdef CONFIG_ITRACE
+#define NR_RECORD CONFIG_ITRACE_RING_SIZE
+
+// Instructions are recorded in binary, and only formatted and
+// disassembled when they are printed.
+typedef struct {
+  vaddr_t pc;
+  uint32_t inst;
+  int len;
+} ItraceRecord;
+
+static ItraceRecord ring[NR_RECORD] = {};
+static uint64_t nr_record = 0;
+
+void itrace_record(vaddr_t pc, uint32_t inst, int len) {
+  ItraceRecord *r = &ring[nr_record % NR_RECORD];
+  r->pc = pc;
+  r->inst = inst;
+  r->len = len;
+  nr_record ++;
+}
+
+void itrace_format(char *buf, int size, vaddr_t pc, uint32_t inst, int len) {
+  char *p = buf;
+  p += snprintf(p, size, FMT_WORD ":", pc);
+  int i;
+  uint8_t *code = (uint8_t *)&inst;
+  for (i = len - 1; i >= 0; i --) {
+    p += snprintf(p, 4, " %02x", code[i]);
+  }
+  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
+  int space_len = ilen_max - len;
+  if (space_len < 0) space_len = 0;
+  space_len = space_len * 3 + 1;
+  memset(p, ' ', space_len);
+  p += space_len;
+
+#ifndef CONFIG_ISA_loongarch32r
+  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+  disassemble(p, buf + size - p, MUXDEF(CONFIG_ISA_x86, pc + len, pc), code, len);
+#else
+  p[0] = '\0'; // the upstream llvm does not support loongarch32r
+#endif
+}
+
+// Print the recently executed instructions, the last one is marked.
+void itrace_dump() {
+  extern FILE* log_fp;
+  void log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+  uint64_t start = (nr_record > NR_RECORD ? nr_record - NR_RECORD : 0);
+  uint64_t i;
+  char buf[128];
+  printf("Recently executed instructions:\n");
+  if (log_fp != stdout) log_printf("Recently executed instructions:\n");
+  for (i = start; i < nr_record; i ++) {
+    ItraceRecord *r = &ring[i % NR_RECORD];
+    itrace_format(buf, sizeof(buf), r->pc, r->inst, r->len);
+    const char *mark = (i == nr_record - 1 ? "--> " : "    ");
+    word_t offset = 0;
+    const char *func = symbol_lookup(r->pc, &offset);
+    if (func != NULL) {
+      int len = strlen(buf);
+      snprintf(buf + len, sizeof(buf) - len, "  <%s+0x%x>", func, (uint32_t)offset);
+    }
+    printf("%s%s\n", mark, buf);
+    if (log_fp != stdout) log_printf("%s%s\n", mark, buf);
+  }
+}
+#endif
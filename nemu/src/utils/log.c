@@ -18,14 +18,149 @@
 extern uint64_t g_nr_guest_inst;
 
 #ifndef CONFIG_TARGET_AM
+#include <pthread.h>
+#include <stdarg.h>
+
 FILE *log_fp = NULL;
 
+/* Records written to a log file are appended to a large buffer owned
+ * by the calling thread. Full buffers are written to the file by a
+ * background thread, so that tracing is not bound by write syscalls.
+ * Records written to stdout are still written immediately to keep
+ * them in order with printf().
+ */
+#define LOG_BUF_SIZE (1 << 20)
+#define NR_LOG_BUF 8
+
+typedef struct LogBuf {
+  struct LogBuf *next;
+  size_t len;
+  char data[LOG_BUF_SIZE];
+} LogBuf;
+
+static bool log_async = false;
+static LogBuf *free_list = NULL, *full_head = NULL, *full_tail = NULL;
+static int nr_writing = 0;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_full = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond_free = PTHREAD_COND_INITIALIZER;
+static __thread LogBuf *cur = NULL;
+
+static void submit_buf(LogBuf *b) {
+  pthread_mutex_lock(&log_lock);
+  b->next = NULL;
+  if (full_tail) full_tail->next = b;
+  else full_head = b;
+  full_tail = b;
+  pthread_cond_signal(&cond_full);
+  pthread_mutex_unlock(&log_lock);
+}
+
+static LogBuf* get_free_buf() {
+  pthread_mutex_lock(&log_lock);
+  while (free_list == NULL) pthread_cond_wait(&cond_free, &log_lock);
+  LogBuf *b = free_list;
+  free_list = b->next;
+  pthread_mutex_unlock(&log_lock);
+  b->len = 0;
+  return b;
+}
+
+static void* log_writer(void *arg) {
+  pthread_mutex_lock(&log_lock);
+  while (true) {
+    while (full_head == NULL) pthread_cond_wait(&cond_full, &log_lock);
+    LogBuf *b = full_head;
+    full_head = b->next;
+    if (full_head == NULL) full_tail = NULL;
+    nr_writing ++;
+    pthread_mutex_unlock(&log_lock);
+
+    fwrite(b->data, 1, b->len, log_fp);
+
+    pthread_mutex_lock(&log_lock);
+    b->next = free_list;
+    free_list = b;
+    nr_writing --;
+    pthread_cond_broadcast(&cond_free);
+  }
+  return NULL;
+}
+
+void log_printf(const char *fmt, ...) {
+  va_list ap;
+  if (!log_async) {
+    va_start(ap, fmt);
+    vfprintf(log_fp, fmt, ap);
+    va_end(ap);
+    fflush(log_fp);
+    return;
+  }
+
+  if (cur == NULL) cur = get_free_buf();
+  size_t left = LOG_BUF_SIZE - cur->len;
+  va_start(ap, fmt);
+  int n = vsnprintf(cur->data + cur->len, left, fmt, ap);
+  va_end(ap);
+  if (n >= left) {
+    // the record does not fit, put it into a new buffer
+    submit_buf(cur);
+    cur = get_free_buf();
+    va_start(ap, fmt);
+    n = vsnprintf(cur->data, LOG_BUF_SIZE, fmt, ap);
+    va_end(ap);
+    if (n >= LOG_BUF_SIZE) n = LOG_BUF_SIZE - 1;
+  }
+  if (n > 0) cur->len += n;
+}
+
+// Write the records of the calling thread to the log file,
+// and wait until all submitted buffers are written.
+void log_flush() {
+  if (log_fp == NULL) return;
+  if (log_async) {
+    if (cur != NULL && cur->len > 0) {
+      submit_buf(cur);
+      cur = NULL;
+    }
+    pthread_mutex_lock(&log_lock);
+    while (full_head != NULL || nr_writing > 0) pthread_cond_wait(&cond_free, &log_lock);
+    pthread_mutex_unlock(&log_lock);
+  }
+  fflush(log_fp);
+}
+
+// Only the calling thread is copied by fork(). Records of the child
+// are written synchronously since there is no writer thread.
+static void log_atfork_child() {
+  pthread_mutex_init(&log_lock, NULL);
+  log_async = false;
+}
+
+static void init_log_writer() {
+  int i;
+  for (i = 0; i < NR_LOG_BUF; i ++) {
+    LogBuf *b = malloc(sizeof(LogBuf));
+    assert(b);
+    b->next = free_list;
+    free_list = b;
+  }
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, log_writer, NULL);
+  Assert(ret == 0, "Can not create the log writer thread");
+  pthread_detach(thread);
+  log_async = true;
+  atexit(log_flush);
+  pthread_atfork(NULL, NULL, log_atfork_child);
+}
+
 void init_log(const char *log_file) {
   log_fp = stdout;
   if (log_file != NULL) {
     FILE *fp = fopen(log_file, "w");
     Assert(fp, "Can not open '%s'", log_file);
     log_fp = fp;
+    init_log_writer();
   }
   Log("Log is written to %s", log_file ? log_file : "stdout");
 }
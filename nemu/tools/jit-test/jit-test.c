@@ -0,0 +1,160 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+/* Write a riscv32 image to stdout. The image runs a loop covering the
+ * RV32I instructions translated by the JIT, which gets hot after a few
+ * iterations, and compares the result with the one computed by the same
+ * operations in C below. It hits GOOD TRAP if they are equal.
+ */
+#define NR_ITER 100000
+#define BUF_OFF 0x1000 // data buffer, relative to the start of the image
+
+enum { zero = 0, ra = 1, sp = 2, t0 = 5, t1 = 6, t2 = 7, s0 = 8, s1 = 9,
+  a0 = 10, t3 = 28, t4 = 29, t5 = 30, t6 = 31 };
+
+static uint32_t code[64];
+static int pc = 0;
+
+static void emit(uint32_t inst) { assert(pc < 64); code[pc ++] = inst; }
+
+static void R(int f7, int rs2, int rs1, int f3, int rd, int op) {
+  emit((f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op);
+}
+static void I(int imm, int rs1, int f3, int rd, int op) {
+  emit(((imm & 0xfff) << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op);
+}
+static void S(int imm, int rs2, int rs1, int f3) {
+  emit((((imm >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | ((imm & 0x1f) << 7) | 0x23);
+}
+static void B(int target, int rs2, int rs1, int f3) {
+  uint32_t o = (target - pc) * 4;
+  emit((((o >> 12) & 1) << 31) | (((o >> 5) & 0x3f) << 25) | (rs2 << 20) | (rs1 << 15) |
+      (f3 << 12) | (((o >> 1) & 0xf) << 8) | (((o >> 11) & 1) << 7) | 0x63);
+}
+static void J(int target, int rd) {
+  uint32_t o = (target - pc) * 4;
+  emit((((o >> 20) & 1) << 31) | (((o >> 1) & 0x3ff) << 21) | (((o >> 11) & 1) << 20) |
+      (((o >> 12) & 0xff) << 12) | (rd << 7) | 0x6f);
+}
+static void li(int rd, uint32_t x) {
+  uint32_t hi = (x + 0x800) & 0xfffff000;
+  emit(hi | (rd << 7) | 0x37);                    // lui
+  I(x - hi, rd, 0, rd, 0x13);                     // addi
+}
+
+// the same operations as the guest loop
+static uint32_t expected() {
+  static uint8_t buf[4096];
+  uint32_t x = 0, i, c = 0x12345678;
+  for (i = 0; i < NR_ITER; i ++) {
+    uint32_t v0 = x + i, v1 = v0 ^ c, v2 = v1 << 3, v3 = (int32_t)v1 >> 2, v4 = v1 >> 5;
+    uint32_t v5 = (v2 - v3) | v4;
+    v2 = v5 & 0x7f0;
+    memcpy(buf + v2, &v5, 4);
+    int16_t h; memcpy(&h, buf + v2 + 2, 2);
+    v4 = (int32_t)h;
+    v3 = buf[v2 + 1];
+    v5 = v5 + v4 - v3;
+    v0 = (int32_t)v5 < (int32_t)x;
+    v1 = v5 < x;
+    v5 += v0;
+    v1 <<= (i & 31);
+    x = v5 ^ v1;
+    if ((int32_t)x < 0) x ^= 0x55;
+    x += (x < 0x100);
+    // function
+    v0 = (x >> (i & 31)) | 1;
+    x += v0;
+    buf[5] = v0;
+    v1 = (int32_t)(int8_t)buf[5];
+    uint16_t u = v1; memcpy(buf + 8, &u, 2);
+    memcpy(&u, buf + 8, 2);
+    uint32_t w; memcpy(&w, buf + 8, 4);
+    x ^= u + w;
+    if (x == v1) x ++;
+    if (x < v0) x -= 3;
+  }
+  return x;
+}
+
+int main() {
+  li(sp, 0x80000000 + BUF_OFF);
+  S(8, zero, sp, 2);                              // sw   zero, 8(sp), read by lw below
+  I(0, zero, 0, s0, 0x13);                        // addi s0, zero, 0
+  li(s1, NR_ITER);
+  I(0, zero, 0, a0, 0x13);                        // addi a0, zero, 0
+  li(t6, 0x12345678);
+  int loop = pc;
+  R(0x00, s0, a0, 0, t0, 0x33);                   // add  t0, a0, s0
+  R(0x00, t6, t0, 4, t1, 0x33);                   // xor  t1, t0, t6
+  I(3, t1, 1, t2, 0x13);                          // slli t2, t1, 3
+  I(0x400 | 2, t1, 5, t3, 0x13);                  // srai t3, t1, 2
+  I(5, t1, 5, t4, 0x13);                          // srli t4, t1, 5
+  R(0x20, t3, t2, 0, t5, 0x33);                   // sub  t5, t2, t3
+  R(0x00, t4, t5, 6, t5, 0x33);                   // or   t5, t5, t4
+  I(0x7f0, t5, 7, t2, 0x13);                      // andi t2, t5, 0x7f0
+  R(0x00, t2, sp, 0, t3, 0x33);                   // add  t3, sp, t2
+  S(0, t5, t3, 2);                                // sw   t5, 0(t3)
+  I(2, t3, 1, t4, 0x03);                          // lh   t4, 2(t3)
+  I(1, t3, 4, t2, 0x03);                          // lbu  t2, 1(t3)
+  R(0x00, t4, t5, 0, t5, 0x33);                   // add  t5, t5, t4
+  R(0x20, t2, t5, 0, t5, 0x33);                   // sub  t5, t5, t2
+  R(0x00, a0, t5, 2, t0, 0x33);                   // slt  t0, t5, a0
+  R(0x00, a0, t5, 3, t1, 0x33);                   // sltu t1, t5, a0
+  R(0x00, t0, t5, 0, t5, 0x33);                   // add  t5, t5, t0
+  R(0x00, s0, t1, 1, t1, 0x33);                   // sll  t1, t1, s0
+  R(0x00, t1, t5, 4, a0, 0x33);                   // xor  a0, t5, t1
+  B(pc + 2, zero, a0, 5);                         // bge  a0, zero, 1f
+  I(0x55, a0, 4, a0, 0x13);                       // xori a0, a0, 0x55
+  I(0x100, a0, 3, t0, 0x13);                      // 1: sltiu t0, a0, 0x100
+  R(0x00, t0, a0, 0, a0, 0x33);                   // add  a0, a0, t0
+  int call = pc;
+  J(0, ra);                                       // jal  ra, func (patched below)
+  I(1, s0, 0, s0, 0x13);                          // addi s0, s0, 1
+  B(loop, s1, s0, 1);                             // bne  s0, s1, loop
+  li(t0, expected());
+  R(0x20, t0, a0, 0, a0, 0x33);                   // sub  a0, a0, t0
+  emit(0x00100073);                               // ebreak
+
+  int func = pc;
+  R(0x00, s0, a0, 5, t0, 0x33);                   // srl  t0, a0, s0
+  I(1, t0, 6, t0, 0x13);                          // ori  t0, t0, 1
+  R(0x00, t0, a0, 0, a0, 0x33);                   // add  a0, a0, t0
+  S(5, t0, sp, 0);                                // sb   t0, 5(sp)
+  I(5, sp, 0, t1, 0x03);                          // lb   t1, 5(sp)
+  S(8, t1, sp, 1);                                // sh   t1, 8(sp)
+  I(8, sp, 5, t2, 0x03);                          // lhu  t2, 8(sp)
+  I(8, sp, 2, t3, 0x03);                          // lw   t3, 8(sp)
+  R(0x00, t3, t2, 0, t2, 0x33);                   // add  t2, t2, t3
+  R(0x00, t2, a0, 4, a0, 0x33);                   // xor  a0, a0, t2
+  B(pc + 2, t1, a0, 1);                           // bne  a0, t1, 1f
+  I(1, a0, 0, a0, 0x13);                          // addi a0, a0, 1
+  B(pc + 2, t0, a0, 7);                           // 1: bgeu a0, t0, 2f
+  I(-3, a0, 0, a0, 0x13);                         // addi a0, a0, -3
+  I(0, ra, 0, zero, 0x67);                        // 2: jalr zero, 0(ra)
+
+  int end = pc;
+  pc = call;
+  J(func, ra);
+  pc = end;
+
+  fwrite(code, sizeof(code[0]), pc, stdout);
+  return 0;
+}
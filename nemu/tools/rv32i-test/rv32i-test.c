@@ -0,0 +1,315 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+/* Write a riscv32 image to stdout. The image runs each RV32I instruction
+ * of the interpreter on a set of operands, and checks the result with the
+ * one computed in C below. Each check is a numbered case, and its
+ * description is written to stderr. The image hits GOOD TRAP if all cases
+ * pass, otherwise it hits BAD TRAP with $a0 set to the failed case.
+ */
+#define IMG_BASE 0x80000000u
+#define BUF_ADDR 0x80100000u // data buffer, after the image
+#define NR_CODE (64 * 1024)
+
+enum { zero = 0, ra = 1, sp = 2, t0 = 5, t1 = 6, t2 = 7, a0 = 10, t6 = 31 };
+
+static uint32_t code[NR_CODE];
+static int pc = 0;
+static int nr_case = 0;
+
+static uint32_t pc_addr(int idx) { return IMG_BASE + idx * 4; }
+
+static void emit(uint32_t inst) { assert(pc < NR_CODE); code[pc ++] = inst; }
+
+static void R(int f7, int rs2, int rs1, int f3, int rd, int op) {
+  emit((f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op);
+}
+static void I(int imm, int rs1, int f3, int rd, int op) {
+  emit(((imm & 0xfff) << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op);
+}
+static void S(int imm, int rs2, int rs1, int f3) {
+  emit((((imm >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | ((imm & 0x1f) << 7) | 0x23);
+}
+static void B(int target, int rs2, int rs1, int f3) {
+  uint32_t o = (target - pc) * 4;
+  emit((((o >> 12) & 1) << 31) | (((o >> 5) & 0x3f) << 25) | (rs2 << 20) | (rs1 << 15) |
+      (f3 << 12) | (((o >> 1) & 0xf) << 8) | (((o >> 11) & 1) << 7) | 0x63);
+}
+static void J(int target, int rd) {
+  uint32_t o = (target - pc) * 4;
+  emit((((o >> 20) & 1) << 31) | (((o >> 1) & 0x3ff) << 21) | (((o >> 11) & 1) << 20) |
+      (((o >> 12) & 0xff) << 12) | (rd << 7) | 0x6f);
+}
+static void U(uint32_t imm, int rd, int op) { emit((imm & 0xfffff000) | (rd << 7) | op); }
+// always two instructions, so that the length of a check is fixed
+static void li(int rd, uint32_t x) {
+  uint32_t hi = (x + 0x800) & 0xfffff000;
+  U(hi, rd, 0x37);                                // lui
+  I(x - hi, rd, 0, rd, 0x13);                     // addi
+}
+
+// Check that `rd' holds `expect', or stop with $a0 = the number of the case.
+static void check(int rd, uint32_t expect, const char *fmt, ...) {
+  va_list ap;
+  nr_case ++;
+  fprintf(stderr, "case %d: ", nr_case);
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fprintf(stderr, " = 0x%08x\n", expect);
+  li(t6, expect);
+  B(pc + 4, t6, rd, 0);                           // beq  rd, t6, 1f
+  li(a0, nr_case);
+  emit(0x00100073);                               // ebreak
+}
+
+static const uint32_t vals[] = { 0, 1, 2, 31, 32, 0x7ff, 0x800, 0x12345678,
+  0x7fffffff, 0x80000000, 0x80000001, 0xfffff800, 0xfffffffe, 0xffffffff };
+#define NR_VAL (sizeof(vals) / sizeof(vals[0]))
+
+static const int imms[] = { 0, 1, -1, 31, 0x555, 0x7ff, -0x800 };
+#define NR_IMM (sizeof(imms) / sizeof(imms[0]))
+
+// funct3 and the bit 30 (funct7) select the operation in both OP and OP-IMM
+static uint32_t alu(int f3, int f7, uint32_t x, uint32_t y) {
+  switch (f3) {
+    case 0: return f7 ? x - y : x + y;
+    case 1: return x << (y & 31);
+    case 2: return (int32_t)x < (int32_t)y;
+    case 3: return x < y;
+    case 4: return x ^ y;
+    case 5: return f7 ? (uint32_t)((int32_t)x >> (y & 31)) : x >> (y & 31);
+    case 6: return x | y;
+    case 7: return x & y;
+  }
+  assert(0);
+}
+
+static const struct { const char *name; int f3, f7; } alu_ops[] = {
+  { "add", 0, 0 }, { "sub", 0, 0x20 }, { "sll", 1, 0 }, { "slt", 2, 0 }, { "sltu", 3, 0 },
+  { "xor", 4, 0 }, { "srl", 5, 0 }, { "sra", 5, 0x20 }, { "or", 6, 0 }, { "and", 7, 0 },
+};
+
+static void test_op() {
+  int i, x, y;
+  for (i = 0; i < sizeof(alu_ops) / sizeof(alu_ops[0]); i ++) {
+    int f3 = alu_ops[i].f3, f7 = alu_ops[i].f7;
+    for (x = 0; x < NR_VAL; x ++) {
+      for (y = 0; y < NR_VAL; y ++) {
+        li(t0, vals[x]);
+        li(t1, vals[y]);
+        R(f7, t1, t0, f3, t2, 0x33);              // op   t2, t0, t1
+        check(t2, alu(f3, f7, vals[x], vals[y]), "%s 0x%08x, 0x%08x", alu_ops[i].name, vals[x], vals[y]);
+      }
+    }
+    // the destination is also the source
+    li(t0, 0x87654321);
+    R(f7, t0, t0, f3, t0, 0x33);                  // op   t0, t0, t0
+    check(t0, alu(f3, f7, 0x87654321, 0x87654321), "%s 0x%08x, 0x%08x (rd = rs1 = rs2)",
+        alu_ops[i].name, 0x87654321, 0x87654321);
+  }
+}
+
+static void test_op_imm() {
+  static const struct { const char *name; int f3; } ops[] = {
+    { "addi", 0 }, { "slti", 2 }, { "sltiu", 3 }, { "xori", 4 }, { "ori", 6 }, { "andi", 7 },
+  };
+  static const int shamts[] = { 0, 1, 5, 31 };
+  int i, x, y;
+  for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i ++) {
+    for (x = 0; x < NR_VAL; x ++) {
+      for (y = 0; y < NR_IMM; y ++) {
+        li(t0, vals[x]);
+        I(imms[y], t0, ops[i].f3, t2, 0x13);      // op   t2, t0, imm
+        check(t2, alu(ops[i].f3, 0, vals[x], imms[y]), "%s 0x%08x, %d", ops[i].name, vals[x], imms[y]);
+      }
+    }
+  }
+  // an immediate operand which is the number of a register holding another value
+  li(t0, 100);
+  li(t1, 7);
+  I(t1, t0, 0, t2, 0x13);                         // addi t2, t0, 6
+  check(t2, 100 + t1, "%s 0x%08x, %d (imm = index of t1)", "addi", 100, t1);
+
+  static const struct { const char *name; int f3, f7; } shifts[] = {
+    { "slli", 1, 0 }, { "srli", 5, 0 }, { "srai", 5, 0x20 },
+  };
+  for (i = 0; i < sizeof(shifts) / sizeof(shifts[0]); i ++) {
+    for (x = 0; x < NR_VAL; x ++) {
+      for (y = 0; y < sizeof(shamts) / sizeof(shamts[0]); y ++) {
+        li(t0, vals[x]);
+        I((shifts[i].f7 << 5) | shamts[y], t0, shifts[i].f3, t2, 0x13);
+        check(t2, alu(shifts[i].f3, shifts[i].f7, vals[x], shamts[y]), "%s 0x%08x, %d",
+            shifts[i].name, vals[x], shamts[y]);
+      }
+    }
+  }
+}
+
+static void test_upper() {
+  static const uint32_t uimms[] = { 0, 0x1000, 0x7ffff000, 0x80000000, 0xfffff000 };
+  int i;
+  for (i = 0; i < sizeof(uimms) / sizeof(uimms[0]); i ++) {
+    U(uimms[i], t2, 0x37);                        // lui  t2, imm
+    check(t2, uimms[i], "lui 0x%08x", uimms[i]);
+    uint32_t here = pc_addr(pc);
+    U(uimms[i], t2, 0x17);                        // auipc t2, imm
+    check(t2, here + uimms[i], "auipc 0x%08x at 0x%08x", uimms[i], here);
+  }
+}
+
+static void test_jump() {
+  // jal: forward, skipping an instruction which clobbers t1
+  li(t1, 0);
+  uint32_t link = pc_addr(pc + 1);
+  J(pc + 2, t2);                                  // jal  t2, 1f
+  I(1, zero, 0, t1, 0x13);                        // addi t1, zero, 1
+  check(t2, link, "jal link 0x%08x", link);
+  check(t1, 0, "jal skipped 0x%08x", link);
+
+  // jal: backward, to a jal which jumps forward again
+  li(t1, 0);
+  int back = pc;
+  J(pc + 2, zero);                                // jal  zero, 2f
+  J(pc + 3, zero);                                // 1: jal zero, 3f
+  J(back + 1, t2);                                // 2: jal t2, 1b
+  I(1, zero, 0, t1, 0x13);                        // addi t1, zero, 1
+                                                  // 3:
+  check(t2, pc_addr(back + 3), "jal backward link 0x%08x", pc_addr(back + 3));
+  check(t1, 0, "jal backward skipped 0x%08x", pc_addr(back + 3));
+
+  // jalr: the lowest bit of the target is cleared, and rd = rs1 reads rs1 first
+  static const int offs[] = { 0, 1, -4, -3 };
+  int i;
+  for (i = 0; i < sizeof(offs) / sizeof(offs[0]); i ++) {
+    int rd = (i % 2 ? t0 : t2);
+    li(t1, 0);
+    uint32_t target = pc_addr(pc + 4);            // 1: below
+    li(t0, target - (offs[i] & ~1));
+    link = pc_addr(pc + 1);
+    I(offs[i], t0, 0, rd, 0x67);                  // jalr rd, off(t0)
+    I(1, zero, 0, t1, 0x13);                      // addi t1, zero, 1
+    assert(pc_addr(pc) == target);
+    check(rd, link, "%s link 0x%08x, off %d", "jalr", link, offs[i]);
+    check(t1, 0, "%s skipped 0x%08x, off %d", "jalr", link, offs[i]);
+  }
+}
+
+static void test_branch() {
+  static const struct { const char *name; int f3; } ops[] = {
+    { "beq", 0 }, { "bne", 1 }, { "blt", 4 }, { "bge", 5 }, { "bltu", 6 }, { "bgeu", 7 },
+  };
+  static const uint32_t bvals[] = { 0, 1, 0x7fffffff, 0x80000000, 0xffffffff };
+  int i, x, y;
+  for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i ++) {
+    for (x = 0; x < sizeof(bvals) / sizeof(bvals[0]); x ++) {
+      for (y = 0; y < sizeof(bvals) / sizeof(bvals[0]); y ++) {
+        uint32_t a = bvals[x], b = bvals[y];
+        bool taken;
+        switch (ops[i].f3) {
+          case 0: taken = a == b; break;
+          case 1: taken = a != b; break;
+          case 4: taken = (int32_t)a < (int32_t)b; break;
+          case 5: taken = (int32_t)a >= (int32_t)b; break;
+          case 6: taken = a < b; break;
+          default: taken = a >= b; break;
+        }
+        li(t0, a);
+        li(t1, b);
+        I(0, zero, 0, t2, 0x13);                  // addi t2, zero, 0
+        B(pc + 2, t1, t0, ops[i].f3);             // bxx  t0, t1, 1f
+        I(1, zero, 0, t2, 0x13);                  // addi t2, zero, 1
+        check(t2, !taken, "%s 0x%08x, 0x%08x (not taken)", ops[i].name, a, b);
+      }
+    }
+  }
+  // backward
+  li(t0, 0);
+  li(t1, 3);
+  int loop = pc;
+  I(1, t0, 0, t0, 0x13);                          // 1: addi t0, t0, 1
+  B(loop, t1, t0, 1);                             // bne  t0, t1, 1b
+  check(t0, 3, "%s backward loop 0x%08x, 0x%08x", "bne", 0, 3);
+}
+
+static uint8_t mem[32]; // the content of the buffer at BUF_ADDR
+
+static void store(int f3, int off, uint32_t v) {
+  li(t1, v);
+  S(off, t1, sp, f3);                             // sx   t1, off(sp)
+  memcpy(mem + 16 + off, &v, 1 << f3);
+}
+
+static void load(int f3, int off, const char *name) {
+  uint32_t v = 0;
+  int len = 1 << (f3 & 3);
+  memcpy(&v, mem + 16 + off, len);
+  if (!(f3 & 4) && len < 4) { v = (uint32_t)((int32_t)(v << (32 - 8 * len)) >> (32 - 8 * len)); }
+  I(off, sp, f3, t2, 0x03);                       // lx   t2, off(sp)
+  check(t2, v, "%s %d(0x%08x)", name, off, BUF_ADDR + 16);
+}
+
+static void test_mem() {
+  static const uint32_t pats[] = { 0x8081f2f3, 0x7f017e02 };
+  int i, off;
+  li(sp, BUF_ADDR + 16);
+  for (i = 0; i < sizeof(pats) / sizeof(pats[0]); i ++) {
+    for (off = -16; off < 16; off += 4) { store(2, off, pats[i] + off); }
+    for (off = -16; off < 16; off += 4) { load(2, off, "lw"); }
+    for (off = -16; off < 16; off += 2) { load(1, off, "lh"); load(5, off, "lhu"); }
+    for (off = -16; off < 16; off ++) { load(0, off, "lb"); load(4, off, "lbu"); }
+    store(1, -6, pats[i] >> 8);
+    store(1, 2, ~pats[i]);
+    store(0, -13, pats[i] >> 16);
+    store(0, 7, pats[i]);
+    for (off = -16; off < 16; off += 4) { load(2, off, "lw"); }
+  }
+}
+
+static void test_misc() {
+  // writes to zero are dropped
+  I(5, zero, 0, zero, 0x13);                      // addi zero, zero, 5
+  U(0x12345000, zero, 0x37);                      // lui  zero, 0x12345
+  li(sp, BUF_ADDR);
+  I(0, sp, 2, zero, 0x03);                        // lw   zero, 0(sp)
+  R(0, zero, zero, 0, t2, 0x33);                  // add  t2, zero, zero
+  check(t2, 0, "writes to zero");
+  emit(0x0ff0000f);                               // fence
+  li(t2, 42);
+  check(t2, 42, "fence");
+}
+
+int main() {
+  test_upper();
+  test_op_imm();
+  test_op();
+  test_jump();
+  test_branch();
+  test_mem();
+  test_misc();
+  I(0, zero, 0, a0, 0x13);                        // addi a0, zero, 0
+  emit(0x00100073);                               // ebreak
+  assert(pc_addr(pc) <= BUF_ADDR - 32);
+
+  fwrite(code, sizeof(code[0]), pc, stdout);
+  return 0;
+}